@@ -4,11 +4,51 @@
 
 // project files
 #include "ChangeClk.h"
+#include "spsc_queue.h"
+#include "Timer.h"
 #include "UART2.h" // for testing / debugging only
 
+#define ADC_QUEUE_BLOCKS 4 // power of two, 32 samples of slack for the main loop
+
 // callback
 static void (* todo_callback)(void);
 
+// do_ADC, 4^n conversions per reading
+static unsigned char oversample_bits = 0;
+
+// acquisition: the isr fills blocks, the main loop takes them
+SPSC_QUEUE(adc_block, struct adc_block, ADC_QUEUE_BLOCKS)
+static struct adc_block_queue blocks;
+static volatile uint32_t block_count = 0;
+static volatile uint16_t isr_cycles_max = 0;
+static const unsigned char kCyclesPerTick = 8; // fcy / TIMESTAMP_TICK_HZ
+static const unsigned char kAdcPriority = 4;
+static const unsigned char kScanChannels = 16; // AD1CSSL bits
+static const unsigned char kTriggerCounter = 0b111; // SSRC: the internal counter
+static const unsigned char kTriggerTimer3 = 0b010; // SSRC: timer 3 period match
+static const int16_t kJitterClip = 0x3fff; // ticks, still fits in int16 as us
+
+// scan: one ring per entry of the list, the isr fills them
+SPSC_QUEUE(adc_sample, uint16_t, ADC_RING)
+static struct adc_sample_queue rings[ADC_SCAN_MAX];
+static struct adc_scan_config scan; // kept to resume after a ctmu burst
+static struct adc_acq_config stream; // same
+static uint16_t period_ticks = 0; // timer 3 triggered stream, 0 if free running
+static char t3_shortened = 0; // the stream set the T3 period, whoever owns the adc now
+static uint32_t timed_first = 0; // interrupt timestamps of the first and last block
+static uint32_t timed_last = 0;
+static uint32_t timed_blocks = 0;
+static int16_t jitter_min = 0; // in ticks
+static int16_t jitter_max = 0;
+static unsigned char slot_index[ADC_SCAN_MAX]; // buffer slot -> list index
+static unsigned char countdown[ADC_SCAN_MAX]; // per list index, keep at 0
+static volatile uint32_t scan_count = 0;
+static uint16_t pauses = 0;
+
+// arbitration
+static enum ADC_USER owner = kAdcFree;
+static enum ADC_USER suspended = kAdcFree; // what a burst took it from
+
 
 
 // ****************************************************************** the driver
@@ -66,8 +106,8 @@ void init_ADC(void) {
         AD1CON1bits.ADON = 1; // turns ADC on
 }
 
-// reads values from input and converts to digital representation
-void do_ADC(void) {
+// one sample + conversion, busy waits for it
+unsigned int read_ADC(void) {
         AD1CON1bits.SAMP = 1;           //start sampling input
 
         // check for done bit
@@ -76,15 +116,45 @@ void do_ADC(void) {
 
         AD1CON1bits.SAMP = 0;           //stop sampling
 
-        int buffer_value = 0;
-        buffer_value = ADC1BUF0;        //stores sample result
+        return ADC1BUF0;                //sample result
+}
+
+// rounds to nearest, the sum of 256 10 bit samples needs 18 bits
+uint16_t adc_decimate(uint32_t sum, unsigned char extra_bits) {
+        if (extra_bits == 0) {
+                return sum;
+        }
+        return (sum + (1ul << (extra_bits - 1))) >> extra_bits;
+}
+
+uint16_t read_ADC_oversampled(unsigned char extra_bits) {
+        uint32_t sum = 0;
+        uint16_t count;
+
+        if (extra_bits > ADC_MAX_EXTRA_BITS) {
+                extra_bits = ADC_MAX_EXTRA_BITS;
+        }
+        for (count = 1u << (2 * extra_bits); count; count--) {
+                sum += read_ADC() & 0x03ff;
+        }
+        return adc_decimate(sum, extra_bits);
+}
+
+void adc_set_oversampling(unsigned char extra_bits) {
+        oversample_bits = extra_bits > ADC_MAX_EXTRA_BITS ? ADC_MAX_EXTRA_BITS : extra_bits;
+}
+
+// reads values from input and converts to digital representation
+void do_ADC(void) {
+        unsigned int buffer_value = 0;
+        buffer_value = read_ADC_oversampled(oversample_bits); //stores sample result
 
         //format and diplay the sampled values
         XmitUART2('\r', 1);
 
         int i;
 
-        for (i = 0; i < buffer_value / 30; i++) {
+        for (i = 0; i < (buffer_value >> oversample_bits) / 30; i++) {
                 XmitUART2(220, 1);      //ASCII bar character
         }
 
@@ -94,3 +164,336 @@ void do_ADC(void) {
                 XmitUART2(' ', 1);      //empty spaces for neat output
         }
 }
+
+
+
+// ************************************************************ helper functions
+// after this the isr can't run until the next start
+static void stop_conversions(void) {
+        AD1CON1bits.ASAM = 0;
+        AD1CON1bits.ADON = 0;
+        IEC0bits.AD1IE = 0;
+        IFS0bits.AD1IF = 0;
+}
+
+// auto sample, auto convert, ping-pong halves. the channel selection is done
+static void start_conversions(unsigned char trigger, unsigned char samc,
+                unsigned char adcs, unsigned char per_interrupt) {
+        AD1CHSbits.CH0NA = 0; // vr-
+        AD1CON1bits.FORM = 0b00; // integer
+        AD1CON1bits.SSRC = trigger; // ends sampling
+        AD1CON1bits.ASAM = 1; // and the next sample starts right after
+        AD1CON2bits.VCFG = 0b000; // avdd - avss
+        AD1CON2bits.ALTS = 0;
+        AD1CON2bits.BUFM = 1; // two 8 word halves: we read one while the adc fills the other
+        AD1CON2bits.SMPI = per_interrupt - 1;
+        AD1CON3bits.ADRC = 0; // the ctmu leaves the rc clock selected
+        AD1CON3bits.SAMC = samc;
+        AD1CON3bits.ADCS = adcs;
+
+        start_timestamp_t3();
+        IPC3bits.AD1IP = kAdcPriority;
+        IFS0bits.AD1IF = 0;
+        IEC0bits.AD1IE = 1;
+        AD1CON1bits.ADON = 1;
+}
+
+// back to one T3 interrupt per 131ms, the burst or whatever is next doesn't
+// need the stream's rate interrupt
+static void stream_untime(void) {
+        if (t3_shortened) {
+                set_timestamp_period_t3(0x10000ul);
+                t3_shortened = 0;
+        }
+}
+
+// a ctmu burst restarts the rate measurement, the gap isn't an overrun
+static void stream_setup(void) {
+        stop_conversions();
+        AD1CHSbits.CH0SA = stream.channel;
+        AD1PCFG &= ~(1u << stream.channel); // analog, the pin is an input already
+        AD1CON2bits.CSCNA = 0;
+
+        timed_blocks = 0;
+        jitter_min = kJitterClip;
+        jitter_max = -kJitterClip;
+        if (stream.rate_hz > ADC_MAX_RATE_HZ) {
+                stream.rate_hz = ADC_MAX_RATE_HZ; // see adc_acq_config
+        }
+        if (stream.rate_hz) {
+                uint32_t ticks = (TIMESTAMP_TICK_HZ + stream.rate_hz / 2) / stream.rate_hz;
+                period_ticks = ticks > 0xffff ? 0xffff : ticks; // 7.6Hz at the slowest
+                set_timestamp_period_t3(period_ticks);
+                t3_shortened = 1;
+                start_conversions(kTriggerTimer3, stream.samc, stream.adcs, ADC_BLOCK);
+        } else {
+                period_ticks = 0;
+                stream_untime(); // restarted free running
+                start_conversions(kTriggerCounter, stream.samc, stream.adcs, ADC_BLOCK);
+        }
+}
+
+// the adc converts the AD1CSSL channels lowest first whatever order the list
+// has, so buffer slot k belongs to the kth lowest channel of the list
+static void scan_setup(void) {
+        uint16_t mask = 0;
+        unsigned char slot = 0;
+        unsigned char an;
+        unsigned char i;
+
+        stop_conversions();
+        for (an = 0; an < kScanChannels; an++) {
+                for (i = 0; i < scan.count; i++) {
+                        if (scan.channels[i].channel == an) {
+                                slot_index[slot++] = i;
+                                mask |= 1u << an;
+                        }
+                }
+        }
+        for (i = 0; i < scan.count; i++) {
+                countdown[i] = 1; // the first scan is kept
+        }
+
+        AD1CSSL = mask;
+        AD1PCFG &= ~mask;
+        AD1CON2bits.CSCNA = 1;
+        start_conversions(kTriggerCounter, scan.samc, scan.adcs, scan.count);
+}
+
+// divisor 4 keeps scans 1, 5, 9...
+static void scan_isr(volatile unsigned int *half) {
+        unsigned char slot;
+
+        scan_count++;
+        for (slot = 0; slot < scan.count; slot++) {
+                unsigned char i = slot_index[slot];
+                uint16_t sample;
+
+                if (--countdown[i]) {
+                        continue;
+                }
+                countdown[i] = scan.channels[i].divisor ? scan.channels[i].divisor : 1;
+                sample = half[slot];
+                adc_sample_push(&rings[i], &sample);
+        }
+}
+
+// timed: every block should be 8 periods after the one before
+static void stream_isr(volatile unsigned int *half, uint32_t now) {
+        struct adc_block *block = adc_block_claim(&blocks);
+        unsigned char i;
+
+        if (period_ticks) {
+                if (timed_blocks == 0) {
+                        timed_first = now;
+                } else {
+                        int32_t error = (int32_t)(now - timed_last) - (int32_t)period_ticks * ADC_BLOCK;
+                        int16_t clipped = error > kJitterClip ? kJitterClip
+                                        : (error < -kJitterClip ? -kJitterClip : error);
+                        if (clipped < jitter_min) {
+                                jitter_min = clipped;
+                        }
+                        if (clipped > jitter_max) {
+                                jitter_max = clipped;
+                        }
+                }
+                timed_last = now;
+                timed_blocks++;
+        }
+
+        block_count++;
+        if (!block) {
+                blocks.dropped++; // main loop behind, these 8 are lost
+                return;
+        }
+
+        for (i = 0; i < ADC_BLOCK; i++) {
+                block->samples[i] = half[i];
+        }
+        block->timestamp = now;
+        adc_block_commit(&blocks);
+}
+
+
+
+// ********************************************************** continuous capture
+int adc_acq_start(const struct adc_acq_config *config) {
+        if (!adc_claim(kAdcStream)) {
+                return 0;
+        }
+        stop_conversions();
+        stream = *config;
+        stream_setup();
+        return 1;
+}
+
+void adc_acq_stop(void) {
+        if (suspended == kAdcStream) {
+                suspended = kAdcFree; // stopped during a ctmu burst, don't resume
+        }
+        stream_untime(); // also when a burst has the adc
+        adc_release(kAdcStream);
+}
+
+int adc_get_block(struct adc_block *block) {
+        return adc_block_pop(&blocks, block);
+}
+
+void adc_acq_get_stats(struct adc_acq_stats *stats) {
+        stats->blocks = block_count;
+        stats->dropped = blocks.dropped;
+        stats->high_water = blocks.high_water;
+        stats->isr_cycles_max = isr_cycles_max;
+
+        unsigned char ipl = SRbits.IPL;
+        SRbits.IPL = 7; // the isr writes these
+        uint32_t first = timed_first;
+        uint32_t last = timed_last;
+        uint32_t count = timed_blocks;
+        int16_t low = jitter_min;
+        int16_t high = jitter_max;
+        uint16_t period = period_ticks;
+        SRbits.IPL = ipl;
+
+        stats->rate_mhz = 0;
+        stats->jitter_min_us = 0;
+        stats->jitter_max_us = 0;
+        stats->overruns = 0;
+        if (!period || count < 2 || last == first) {
+                return;
+        }
+
+        uint32_t elapsed = last - first;
+        uint32_t samples = (count - 1) * ADC_BLOCK;
+        uint32_t expected = (elapsed + period / 2) / period;
+        stats->rate_mhz = (uint64_t)samples * TIMESTAMP_TICK_HZ * 1000 / elapsed;
+        stats->jitter_min_us = low * (int16_t)(US_PER_S / TIMESTAMP_TICK_HZ);
+        stats->jitter_max_us = high * (int16_t)(US_PER_S / TIMESTAMP_TICK_HZ);
+        stats->overruns = expected > samples ? expected - samples : 0;
+}
+
+
+
+// ************************************************************************ scan
+int adc_scan_start(const struct adc_scan_config *config) {
+        unsigned char i;
+        unsigned char j;
+
+        if (config->count == 0 || config->count > ADC_SCAN_MAX) {
+                return 0;
+        }
+        for (i = 0; i < config->count; i++) {
+                if (config->channels[i].channel >= kScanChannels) {
+                        return 0; // the internal channels can't be scanned
+                }
+                for (j = 0; j < i; j++) {
+                        if (config->channels[j].channel == config->channels[i].channel) {
+                                return 0; // one AD1CSSL bit, one slot per scan
+                        }
+                }
+        }
+        if (!adc_claim(kAdcScan)) {
+                return 0;
+        }
+
+        stop_conversions();
+        scan = *config;
+        for (i = 0; i < ADC_SCAN_MAX; i++) {
+                rings[i].tail = rings[i].head;
+                rings[i].high_water = 0;
+                rings[i].dropped = 0;
+        }
+        scan_count = 0;
+        pauses = 0;
+        scan_setup();
+        return 1;
+}
+
+void adc_scan_stop(void) {
+        if (suspended == kAdcScan) {
+                suspended = kAdcFree;
+        }
+        adc_release(kAdcScan);
+}
+
+int adc_scan_read(unsigned char index, uint16_t *sample) {
+        if (index >= ADC_SCAN_MAX) {
+                return 0;
+        }
+        return adc_sample_pop(&rings[index], sample);
+}
+
+void adc_scan_get_stats(struct adc_scan_stats *stats) {
+        unsigned char i;
+
+        stats->scans = scan_count;
+        stats->dropped = 0;
+        for (i = 0; i < ADC_SCAN_MAX; i++) {
+                stats->dropped += rings[i].dropped;
+        }
+        stats->pauses = pauses;
+}
+
+
+
+// ***************************************************************** arbitration
+// main loop only. a burst (ctmu, cvref calibration) may take the adc from a
+// stream or a scan, nobody takes it from a burst
+int adc_claim(enum ADC_USER user) {
+        if (owner == kAdcFree || owner == user) {
+                owner = user;
+                return 1;
+        }
+        if (user < kAdcCtmu || owner >= kAdcCtmu) {
+                return 0;
+        }
+
+        stop_conversions(); // the rings keep what they have
+        if (owner == kAdcStream) {
+                stream_untime(); // stream_setup sets it again on release
+        }
+        suspended = owner;
+        owner = user;
+        if (suspended == kAdcScan) {
+                pauses++;
+        }
+        return 1;
+}
+
+// a burst's release restarts whatever it took the adc from, with the whole
+// configuration: the bursts reprogram the mux, the clock and the sequencing
+void adc_release(enum ADC_USER user) {
+        if (owner != user) {
+                return;
+        }
+        stop_conversions();
+        owner = suspended;
+        suspended = kAdcFree;
+        if (owner == kAdcStream) {
+                stream_setup();
+        } else if (owner == kAdcScan) {
+                scan_setup();
+        }
+}
+
+
+
+// *********************************************************** interrupt handler
+// one interrupt per half. BUFS is the half being filled now, the other one is
+// complete and stays put for a whole half more of conversions
+void __attribute__((interrupt, no_auto_psv)) _ADC1Interrupt(void) {
+        uint32_t now = get_timestamp_t3();
+        volatile unsigned int *half = &ADC1BUF0 + (AD1CON2bits.BUFS ? 0 : ADC_BLOCK);
+
+        IFS0bits.AD1IF = 0;
+        if (owner == kAdcScan) {
+                scan_isr(half);
+        } else {
+                stream_isr(half, now);
+        }
+
+        uint16_t cycles = (uint16_t)(get_timestamp_t3() - now) * kCyclesPerTick;
+        if (cycles > isr_cycles_max) {
+                isr_cycles_max = cycles;
+        }
+}
@@ -1,7 +1,107 @@
 #ifndef ADC_H
 #define ADC_H
 
+#include <stdint.h>
+
+#define ADC_BLOCK 8 // samples per interrupt: one half of the ping-pong buffer
+#define ADC_SCAN_MAX 4 // channels per scan, at most ADC_BLOCK: a scan fills one half
+#define ADC_RING 16 // samples per channel ring, power of two
+#define ADC_MAX_EXTRA_BITS 4 // 14 bits from 256 conversions
+#define ADC_MAX_RATE_HZ 5000 // timed streams, see adc_acq_config
+
+// who has the adc. the ctmu and the cvref calibration can take it from a
+// stream or a scan for a burst, they pick up where they were when it is released
+enum ADC_USER {
+        kAdcFree = 0,
+        kAdcStream,
+        kAdcScan,
+        kAdcCtmu,               // the bursts, keep them last
+        kAdcCvref
+};
+
+// a half buffer of consecutive samples, timestamp when its interrupt ran
+struct adc_block {
+        uint16_t samples[ADC_BLOCK];
+        uint32_t timestamp;
+};
+
+/*
+ * auto sample, auto convert: a sample every (samc + 12) TAD, TAD = (adcs + 1) Tcy.
+ * with a rate the timer 3 period match ends each sample instead, samc is unused
+ * and the rate has to leave 12 TAD plus a little sampling per period.
+ * timer 3 is also the timestamp, so a rate costs one T3 interrupt per sample,
+ * not just the adc's one per block. the timestamp only recovers a single
+ * period that T3 was held off for (by the adc isr at the same priority, CN
+ * above it or an IPL 7 section); more are lost for good, and with them the
+ * timestamps, the one-shot deadlines and the rate stats. rates are clamped
+ * to ADC_MAX_RATE_HZ, 100 ticks or 800 Tcy per period, to keep clear of that
+ */
+struct adc_acq_config {
+        unsigned char channel;  // ANx, the pin must already be an input
+        unsigned char samc;     // 1 to 31
+        unsigned char adcs;
+        uint16_t rate_hz;       // 0 free running, else 8 to ADC_MAX_RATE_HZ on timer 3
+};
+
+struct adc_acq_stats {
+        uint32_t blocks;
+        uint16_t dropped;       // blocks the main loop was too slow for
+        uint8_t high_water;     // most blocks queued at once
+        uint16_t isr_cycles_max;
+
+        // with a rate, since the start (or the last ctmu burst)
+        uint32_t rate_mhz;      // achieved, in millihertz
+        int16_t jitter_min_us;  // block interrupt intervals against 8 periods
+        int16_t jitter_max_us;
+        uint16_t overruns;      // periods that produced no sample
+};
+
+// scan: the adc steps through the channels by itself (CSCNA), one conversion
+// every (samc + 12) TAD whatever the channel. a channel keeps every
+// divisor-th of its samples, so it gets rate / (count * divisor)
+struct adc_scan_channel {
+        unsigned char channel;  // ANx 0-15, the pin must already be an input
+        unsigned char divisor;  // 0 or 1 keeps every scan
+};
+
+struct adc_scan_config {
+        struct adc_scan_channel channels[ADC_SCAN_MAX];
+        unsigned char count;
+        unsigned char samc;     // 1 to 31
+        unsigned char adcs;
+};
+
+struct adc_scan_stats {
+        uint32_t scans;
+        uint16_t dropped;       // samples that found their ring full, all channels
+        uint16_t pauses;        // ctmu bursts, each leaves a gap in every ring
+};
+
 void init_ADC(void);
 void do_ADC(void);
+unsigned int read_ADC(void); // one conversion, no output
+
+// oversample and decimate: 4^n conversions summed and shifted right by n give
+// a 10 + n bit result, at 1 / 4^n of the rate. only with an lsb or so of noise
+// on the input, a dead quiet one converts the same code 4^n times
+uint16_t adc_decimate(uint32_t sum, unsigned char extra_bits);
+uint16_t read_ADC_oversampled(unsigned char extra_bits);
+void adc_set_oversampling(unsigned char extra_bits); // for do_ADC, 0 to 4
+
+// continuous acquisition, the adc interrupt moves 8 samples at a time
+int adc_acq_start(const struct adc_acq_config *config); // 0 if the adc is taken
+void adc_acq_stop(void);
+int adc_get_block(struct adc_block *block);
+void adc_acq_get_stats(struct adc_acq_stats *stats);
+
+// scan, samples land in one ring per entry of the channel list
+int adc_scan_start(const struct adc_scan_config *config); // 0 if taken or invalid
+void adc_scan_stop(void);
+int adc_scan_read(unsigned char index, uint16_t *sample); // index into the list
+void adc_scan_get_stats(struct adc_scan_stats *stats);
+
+// arbitration, for drivers that program the adc themselves
+int adc_claim(enum ADC_USER user);
+void adc_release(enum ADC_USER user);
 
 #endif
@@ -0,0 +1,135 @@
+// CN.c
+
+// libraries & header
+#include "CN.h"
+#include "xc.h"
+
+// project files
+#include "Timer.h"
+
+// Magic Numbers
+static const char kEnable = 1;
+static const char kDisable = 0;
+static const unsigned char kCyclesPerTick = 8; // fcy / TIMESTAMP_TICK_HZ
+
+// per port: the pins watched, their level at the last isr, a handler per bit
+static uint16_t watched[kCnPortCount];
+static uint16_t previous[kCnPortCount];
+static cn_handler handlers[kCnPortCount][16];
+static volatile uint32_t isr_cycles_max = 0;
+
+
+
+// ************************************************************ helper functions
+static uint16_t read_port(enum CN_PORT port) {
+        return port == kCnPortA ? PORTA : PORTB;
+}
+
+static void set_input(enum CN_PORT port, uint16_t mask) {
+        if (port == kCnPortA) {
+                TRISA |= mask;
+        } else {
+                TRISB |= mask;
+        }
+}
+
+// CN0-15 live in the '1' registers, CN16 and up in the '2' registers
+static void set_pull(unsigned char cn, enum CN_PULL pull) {
+        uint16_t bit = 1u << (cn & 15);
+        volatile unsigned int *up = cn < 16 ? &CNPU1 : &CNPU2;
+        volatile unsigned int *down = cn < 16 ? &CNPD1 : &CNPD2;
+
+        *up = pull == kCnPullUp ? *up | bit : *up & ~bit;
+        *down = pull == kCnPullDown ? *down | bit : *down & ~bit;
+}
+
+static void enable_cn(unsigned char cn) {
+        if (cn < 16) {
+                CNEN1 |= 1u << cn;
+        } else {
+                CNEN2 |= 1u << (cn - 16);
+        }
+}
+
+// only the changed pins cost anything, one handler call each
+static void dispatch(enum CN_PORT port, uint16_t now, uint16_t timestamp) {
+        uint16_t changed = (now ^ previous[port]) & watched[port];
+        previous[port] = now;
+
+        while (changed) {
+                unsigned char bit = __builtin_ff1r(changed) - 1;
+                changed &= changed - 1;
+                handlers[port][bit]((now >> bit) & 1, timestamp);
+        }
+}
+
+
+
+// *************************************************************** API functions
+void CN_init(void) {
+        unsigned char port;
+
+        IEC1bits.CNIE = kDisable;
+        for (port = 0; port < kCnPortCount; port++) {
+                watched[port] = 0;
+        }
+        CNEN1 = 0;
+        CNEN2 = 0;
+        start_timestamp_t3(); // edge timestamps, and the one shots of the drivers
+
+        IFS1bits.CNIF = 0; // clear interrupt flag if it isn't already
+        IPC4bits.CNIP = 5; // above the one shots (timer 2), so edges nest into them
+        IEC1bits.CNIE = kEnable; // enable CN interrupts in general
+}
+
+int cn_register(unsigned char cn, enum CN_PORT port, uint16_t mask, enum CN_PULL pull,
+                cn_handler handler) {
+        unsigned char bit = __builtin_ff1r(mask) - 1;
+
+        if (!handler || port >= kCnPortCount || !mask || (mask & (mask - 1))
+                        || (watched[port] & mask)) {
+                return 0;
+        }
+
+        IEC1bits.CNIE = kDisable;
+        set_input(port, mask);
+        set_pull(cn, pull);
+        handlers[port][bit] = handler;
+        previous[port] = (previous[port] & ~mask) | (read_port(port) & mask);
+        watched[port] |= mask;
+        enable_cn(cn);
+        IFS1bits.CNIF = 0; // the pull may just have moved the pin
+        IEC1bits.CNIE = kEnable;
+        return 1;
+}
+
+uint16_t cn_snapshot(enum CN_PORT port) {
+        return previous[port];
+}
+
+uint16_t cn_watched(enum CN_PORT port) {
+        return watched[port];
+}
+
+uint32_t cn_isr_cycles_max(void) {
+        return isr_cycles_max;
+}
+
+
+
+// *********************************************************** interrupt handler
+// the only _CNInterrupt: snapshots both ports once, then dispatches the changes
+void __attribute__((interrupt, no_auto_psv)) _CNInterrupt(void) {
+        uint16_t timestamp = get_timestamp_t3(); // low half, wraps at 65536 whatever PR3 is
+        uint16_t port_a = PORTA;
+        uint16_t port_b = PORTB;
+        IFS1bits.CNIF = 0; // clear interrupt flag
+
+        dispatch(kCnPortA, port_a, timestamp);
+        dispatch(kCnPortB, port_b, timestamp);
+
+        uint32_t cycles = (uint32_t)(uint16_t)(get_timestamp_t3() - timestamp) * kCyclesPerTick;
+        if (cycles > isr_cycles_max) {
+                isr_cycles_max = cycles;
+        }
+}
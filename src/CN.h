@@ -0,0 +1,30 @@
+// CN.h
+#ifndef CN_H
+#define CN_H
+
+#include <stdint.h>
+
+enum CN_PORT {kCnPortA = 0, kCnPortB, kCnPortCount};
+enum CN_PULL {kCnPullNone = 0, kCnPullUp, kCnPullDown};
+
+/*
+ * called from the CN isr for every registered pin that changed, with the new
+ * level of the pin and the low half of get_timestamp_t3() at the start of the
+ * isr (TIMESTAMP_TICK_HZ). a pin that toggled twice since the last isr did
+ * not change and is not seen
+ */
+typedef void (* cn_handler)(unsigned char level, uint16_t timestamp);
+
+// CNIE stays on for the whole program, drivers add their pins with cn_register
+void CN_init(void);
+
+// 0 if the pin already has a handler. mask has exactly one bit set
+int cn_register(unsigned char cn, enum CN_PORT port, uint16_t mask, enum CN_PULL pull,
+                cn_handler handler);
+
+// the ports as the running dispatch saw them, for handlers that need several pins
+uint16_t cn_snapshot(enum CN_PORT port);
+uint16_t cn_watched(enum CN_PORT port); // the registered pins, for drivers sharing one
+uint32_t cn_isr_cycles_max(void); // whole dispatch, instruction cycles
+
+#endif
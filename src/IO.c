@@ -6,49 +6,65 @@
 #include "xc.h"
 
 // project files
+#include "button_gesture.h"
 #include "button_state.h" // state machine
 #include "ChangeClk.h"
+#include "CN.h"
+#include "comparator.h"
 #include "IR.h"
+#include "spsc_queue.h"
 #include "Timer.h"
 #include "UART2.h" // for testing / debugging only
 
 // Magic Numbers
-static const char kSetPinToInput = 1;
 static const char kSetPinToOutput = 0;
-static const char kPullUpMode = 1;
 static const char kEnable = 1;
 static const char kDisable = 0;
 static const char INTERNAL = 0;
 static const float kMagicNumber = 1.0/2.0; // for the timers, processor specific :p
+static const uint16_t kSampleTicks = 1000; // 2ms between samples, 4 agreeing samples = 6ms
+static const unsigned char kCyclesPerTick = 8; // fcy / TIMESTAMP_TICK_HZ
+static const struct gesture_config kXmitGestures = {
+        50,     // chord_ms, both buttons together toggle channel / volume
+        3000,   // long_press_ms, holding power turns the tv off
+        300,    // double_click_ms
+        500,    // repeat_delay_ms, holding channel / volume keeps sending
+        200,    // repeat_interval_ms
+};
 
 // statics
 static char btn_verbose_mode = 0;
+static char btn_xmit_mode = 0;
 static char xmit_mode = 1;
 static volatile unsigned char bothButtonsPushed = 0;
 static volatile char power_is_on = 0;
+static char power_hold_sent = 0; // the press of this CN8 hold turned the tv on
+static volatile unsigned char sampling = 0; // debounce samples are being taken
+static volatile struct btn_timing timing;
+
+// just pressed masks, from the sample timer to the main loop
+SPSC_QUEUE(btn_edges, uint16_t, 4)
+static struct btn_edges_queue btn_edges;
+
+static void btn_cn_handler(unsigned char level, uint16_t timestamp);
 
 
 
 // ************************************************************ helper functions
+// input, pulled up (the button connects the pin to ground), CN interrupt on
 static void init_CN0(void) {
-        // note: pin 10 == RB4 == CN1
-        TRISAbits.TRISA4 = kSetPinToInput; // configure IO pin 10/CN0 to be input
-        CNPU1bits.CN1PUE = kPullUpMode; // set pin to be 'pull up' (ie, connected to ground)
-        CNEN1bits.CN0IE = kEnable; // enable CN1 interrupts
+        // note: pin 10 == RA4 == CN0
+        cn_register(0, kCnPortA, 1 << 4, kCnPullUp, btn_cn_handler);
 }
 
 static void init_CN1(void) {
-        // note: pin 9 == RA4 == CN0
-        TRISBbits.TRISB4 = kSetPinToInput; // configure IO pin 9/CN1 to be input
-        CNPU1bits.CN0PUE = kPullUpMode; // set pin to be 'pull up' (ie, connected to ground)
-        CNEN1bits.CN1IE = kEnable; // enable CN0 interrupts
+        // note: pin 9 == RB4 == CN1
+        cn_register(1, kCnPortB, 1 << 4, kCnPullUp, btn_cn_handler);
 }
 
 static void init_CN8(void) {
         // note: pin 14 == RA6 == CN8
-        TRISAbits.TRISA6 = kSetPinToInput; // configure IO pin 8/CN8 to be input
-        CNPU1bits.CN8PUE = kPullUpMode; // set pin to be 'pull up' (ie, connected to ground)
-        CNEN1bits.CN8IE = kEnable; // enable CN8 interrupts
+        cn_register(8, kCnPortA, 1 << 6, kCnPullUp, btn_cn_handler);
 }
 
 static inline void set_timer_priority(int priority) {
@@ -87,6 +103,79 @@ static void delay_us_t3(uint16_t us) {
 
 
 
+// ************************************************************* button handling
+static int countButton = 0;
+
+static void handle_buttons(uint16_t just_pressed) {
+        //check the state of the buttons
+        unsigned char CN0_just_pressed = (just_pressed & BUTTON_MASK(BTN_CN0)) != 0;
+        unsigned char CN1_just_pressed = (just_pressed & BUTTON_MASK(BTN_CN1)) != 0;
+
+        //count number of button being pressed
+        if(CN0_just_pressed) {
+                countButton++;
+        }
+        //set the global var countTarget to count button
+        else if (CN1_just_pressed){
+                divider_set_target(countButton);
+                Disp2Hex(countTarget);      //display the mount of times freq. is divided
+                countButton = 0;            //resets the push button count
+        }
+}
+
+
+
+// ************************************************************ gesture handling
+// Assignment 3: the remote, driven by gestures from the main loop
+static void xmit_gesture(const struct gesture_event *event) {
+        uint16_t buttons = event->buttons;
+
+        switch (event->type) {
+        case kGestureChord:
+                if (buttons != (BUTTON_MASK(BTN_CN0) | BUTTON_MASK(BTN_CN1))) {
+                        break;
+                }
+                if (power_is_on) {
+                        xmit_mode = !xmit_mode;
+                } else {
+                        bothButtonsPushed = 1;
+                }
+                break;
+        case kGesturePress:
+        case kGestureRepeat:
+                if (buttons == BUTTON_MASK(BTN_CN1)) {
+                        xmit_samsung_signal(xmit_mode ? kChannelUpBits : kVolumeUpBits);
+                } else if (buttons == BUTTON_MASK(BTN_CN0)) {
+                        xmit_samsung_signal(xmit_mode ? kChannelDownBits : kVolumeDownBits);
+                } else if (buttons == BUTTON_MASK(BTN_CN8) && event->type == kGesturePress) {
+                        power_hold_sent = !power_is_on; // every hold starts with a press
+                        if (!power_is_on) {
+                                xmit_samsung_signal(kPowerToggleBits);
+                                power_is_on = 1;
+                        }
+                }
+                break;
+        case kGestureLongPress:
+                // one toggle per hold: the press that turned it on doesn't turn it off
+                if (buttons == BUTTON_MASK(BTN_CN8) && power_is_on && !power_hold_sent) {
+                        xmit_samsung_signal(kPowerToggleBits); // held for kXmitGestures.long_press_ms
+                        power_is_on = 0;
+                }
+                break;
+        default:
+                break;
+        }
+}
+
+static void print_gesture(const struct gesture_event *event) {
+        Disp2String("\n\r");
+        Disp2String((char *)gesture_name(event->type));
+        Disp2Hex(event->buttons);
+        Disp2Hex32(event->timestamp);
+}
+
+
+
 // *************************************************************** API functions
 void set_btn_verbose_mode(unsigned char verbose_on) {
         if (verbose_on == 1) {
@@ -96,103 +185,106 @@ void set_btn_verbose_mode(unsigned char verbose_on) {
         }
 }
 
-void CN_init(void) {
+// switches the buttons over to the remote control (assignment 3), call before btn_init
+void set_btn_xmit_mode(unsigned char xmit_on) {
+        btn_xmit_mode = xmit_on == 1;
+}
+
+// drains the button events, only call from the main loop
+void process_btn_events(void) {
+        struct gesture_event event;
+        uint16_t just_pressed;
+
+        while (btn_edges_pop(&btn_edges, &just_pressed)) {
+                handle_buttons(just_pressed);
+        }
+        while (gesture_get_event(&event)) {
+                if (btn_verbose_mode) {
+                        print_gesture(&event);
+                }
+                if (btn_xmit_mode) {
+                        xmit_gesture(&event);
+                }
+        }
+}
+
+// registers the buttons with the CN driver, call CN_init first
+void btn_init(void) {
+        gesture_init(btn_xmit_mode ? &kXmitGestures : 0);
+
         init_CN0();
         init_CN1();
-//        init_CN8();
-
-        IFS1bits.CNIF = 0; // clear interrupt flag if it isn't already
-        IPC4bits.CNIP = 0b101; // set CN interrupt to priority 5
-        IEC1bits.CNIE = kEnable; // enable CN interrupts in general
+        if (btn_xmit_mode) {
+                init_CN8(); // power button
+        }
 }
 
-extern volatile int countTarget;
-static int countButton = 0;
 
 
+// ****************************************************************** sampling
+// sample timer fired: feed the debouncer, keep sampling until it settled
+static void debounce_sample_callback(void) {
+        uint16_t t0 = get_timestamp_t3();
+        uint16_t just_pressed;
 
-// *********************************************************** interrupt handler
-void __attribute__((interrupt, no_auto_psv)) _CNInterrupt(void) {
-        IEC1bits.CNIE = kDisable; // disable CN interrupts in general
-        IFS1bits.CNIF = 0; // clear interrupt flag
+        buttons_update();
+        just_pressed = buttons_just_pressed();
+        gesture_update(buttons_pressed(), get_timestamp_t3());
 
-        /**
-        * Debounce counter:
-        * 20 is calculated by using numbers from calculating clock
-        * to 1/2 is from the magic number var, 1/10 is from how we
-        * want 1/10 seconds length
-        */
-        __delay32(16000/20);
+        // held buttons keep the timer going for long presses and repeats. the
+        // CN isr counts an edge as a bounce while sampling is set, so decide
+        // with CN held off and take one that came after the sample above
+        unsigned char ipl = SRbits.IPL;
+        SRbits.IPL = IPC4bits.CNIP;
+        if (buttons_settling() || gesture_busy() || buttons_sample() != buttons_pressed()) {
+                arm_oneshot_t2(kSampleTicks, debounce_sample_callback);
+        } else {
+                sampling = 0; // an edge from here on finds it clear
+        }
+        SRbits.IPL = ipl;
 
-        //check the state of the buttons
-        unsigned char CN0_just_pressed = get_button_state(BTN_CN0, PORTAbits.RA4==0) == kJustPressed;
-        unsigned char CN1_just_pressed = get_button_state(BTN_CN1, PORTBbits.RB4==0) == kJustPressed;
+        if (just_pressed) {
+                btn_edges_push(&btn_edges, &just_pressed); // handled by the main loop
+        }
 
-        //count number of button being pressed
-        if(CN0_just_pressed) {
-                countButton++;
+        uint32_t cycles = (uint32_t)(uint16_t)(get_timestamp_t3() - t0) * kCyclesPerTick;
+        if (cycles > timing.sample_cycles_max) {
+                timing.sample_cycles_max = cycles;
         }
-        //set the global var countTarget to count button
-        else if (CN1_just_pressed){
-                countTarget = countButton;
-                Disp2Hex(countTarget);      //display the mount of times freq. is divided
-                countButton = 0;            //resets the push button count
+}
+
+
+
+// **************************************************************** measurements
+void get_btn_timing(struct btn_timing *out) {
+        unsigned char ipl = SRbits.IPL;
+        SRbits.IPL = 7; // both the CN isr and the sample timer write it
+        *out = timing;
+        SRbits.IPL = ipl;
+        out->dropped = btn_edges.dropped + gesture_dropped();
+        out->queued_max = btn_edges.high_water > gesture_high_water()
+                        ? btn_edges.high_water : gesture_high_water();
+}
+
+
+
+// ****************************************************************** CN handler
+// only snapshots the pins and schedules the sampling, never waits
+static void btn_cn_handler(unsigned char level, uint16_t timestamp) {
+        uint16_t t0 = get_timestamp_t3();
+
+        timing.edges++;
+        if (sampling) {
+                timing.bounces++; // the running samples will see it settle
+        } else {
+                // the snapshot is the first sample, the timer takes the rest
+                sampling = 1;
+                buttons_update();
+                arm_oneshot_t2(kSampleTicks, debounce_sample_callback);
         }
 
-/**************************DON'T DELETE - Assignment 3*************************/
-//    unsigned char CN0_just_pressed = get_button_state(BTN_CN0, PORTAbits.RA4==0) == kJustPressed;
-//    unsigned char CN1_just_pressed = get_button_state(BTN_CN1, PORTBbits.RB4==0) == kJustPressed;
-//    unsigned char CN8_just_pressed = get_button_state(BTN_CN8, PORTAbits.RA6==0) == kJustPressed;
-//
-//    if(CN0_just_pressed && CN1_just_pressed) {
-//            if (btn_verbose_mode) {
-//                    Disp2String("\n\rBoth buttons pressed!");
-//            }
-//            if (power_is_on) {
-//                xmit_mode = !xmit_mode;
-//            } else {
-//                    bothButtonsPushed = 1;
-//            }
-//    } else if (CN1_just_pressed) {
-//            if (btn_verbose_mode) {
-//                    Disp2String("\n\rRB4/CN1 pressed!");
-//            }
-//            if (xmit_mode) {
-//                    xmit_samsung_signal(kChannelUpBits);
-//            } else {
-//                    xmit_samsung_signal(kVolumeUpBits);
-//            }
-//    } else if (CN0_just_pressed) {
-//            if (btn_verbose_mode) {
-//                    Disp2String("\n\rRA4/CN0 pressed!");
-//            }
-//            if (xmit_mode) {
-//                    xmit_samsung_signal(kChannelDownBits);
-//            } else {
-//                    xmit_samsung_signal(kVolumeDownBits);
-//            }
-//    } else {
-//            // for future implementation
-//    }
-//
-//    if(CN8_just_pressed){
-//        if(power_is_on){
-//            __delay32(4000000*3);
-//            if(get_button_state(BTN_CN8, PORTAbits.RA6==0) == kPressed){
-//                xmit_samsung_signal(kPowerToggleBits);
-//                power_is_on = 0;
-//            }
-//        }
-//        else{
-//            xmit_samsung_signal(kPowerToggleBits);
-//            power_is_on = 1;
-//        }
-//    }
-/*********************************DON'T DELETE********************************/
-
-
-        // re-enable CN interrupts
-        IEC1bits.CNIE = kEnable;
-
-        // bothButtonsPushed = 0;
+        uint32_t cycles = (uint32_t)(uint16_t)(get_timestamp_t3() - t0) * kCyclesPerTick;
+        if (cycles > timing.isr_cycles_max) {
+                timing.isr_cycles_max = cycles;
+        }
 }
@@ -2,7 +2,23 @@
 #ifndef IO_H
 #define	IO_H
 
+#include <stdint.h>
+
+// worst cases, in instruction cycles. the CN handler holds off everything at
+// priority 5 and below, the sample timer (timer 2) everything at 4 and below
+struct btn_timing {
+        uint32_t isr_cycles_max;        // CN handler, per edge (see cn_isr_cycles_max too)
+        uint32_t sample_cycles_max;     // debounce sample, including the button handling
+        uint16_t edges;
+        uint16_t bounces;               // edges that arrived while already sampling
+        uint16_t dropped;               // events lost, the main loop fell behind
+        uint8_t queued_max;             // most events ever waiting for the main loop
+};
+
 void set_btn_verbose_mode(unsigned char verbose_on);
-void CN_init(void);
+void set_btn_xmit_mode(unsigned char xmit_on);
+void process_btn_events(void);
+void btn_init(void);
+void get_btn_timing(struct btn_timing *out);
 
 #endif
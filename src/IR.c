@@ -12,6 +12,7 @@
 
 // project files
 #include "ChangeClk.h"
+#include "CN.h"
 #include "IO.h"
 #include "Timer.h"
 
@@ -20,10 +21,12 @@ static const float kMagicNumber = 1.0/2.0; // for the timers, processor specific
 static const char kEnable = 1;
 static const char kDisable = 0;
 static const char kInternalClk = 0;
+static const char kExternalClk = 1;
 static const char kOutputEnable = 0;
 static const char kOutputDisable = 1;
 
 static unsigned char envelope_flag = 0;
+static void (* t1_count_callback)(void) = 0; // set while timer 1 counts T1CK edges
 static const int US_516 = 2240;
 static const int US_13 = 52;
 static const int US_1690 = 1690*4;
@@ -31,6 +34,15 @@ static const int US_4500 = 4500*4;
 
 
 // ************************************************************ helper functions
+// RA4 as the T1CK input, unless a CN driver has the pin
+static int claim_t1ck(void) {
+        if (cn_watched(kCnPortA) & T1CK_PORTA_MASK) {
+                return 0;
+        }
+        TRISA |= T1CK_PORTA_MASK;
+        return 1;
+}
+
 static inline void set_timer_priority(int priority) {
         if (priority >= 0 && priority <= 7) {
                 IPC15bits.RTCIP = priority;
@@ -41,6 +53,7 @@ static inline void init_timer1(int frequency) {
         // basic config
         NewClk(frequency); // Switch clock: 32 for 32kHz, 500 for 500 kHz, 8 for 8MHz
 
+        t1_count_callback = 0; // the delay owns timer 1 now
         T1CONbits.TCKPS = kDisable; // set pre-scaler (divides timer speed by );
         T1CONbits.TCS = kInternalClk; // use internal clock (ie, not external)
         T1CONbits.TSIDL = kDisable; // one could stop timer when processor idles
@@ -65,6 +78,62 @@ void delay_us_t1(uint16_t us) {
         IEC0bits.T1IE = kEnable; // enable the interrup
 }
 
+// timer 1 counts rising edges on T1CK in hardware and calls back once every
+// edges edges, so the cpu does nothing per edge. 0 stops the counter
+int count_edges_t1(uint16_t edges, void (*callback)(void)) {
+        T1CONbits.TON = kDisable;
+        IEC0bits.T1IE = kDisable;
+        t1_count_callback = 0;
+        if (edges == 0 || !callback) {
+                return 1;
+        }
+        if (!claim_t1ck()) {
+                return 0;
+        }
+
+        T1CONbits.TCKPS = kDisable; // every edge counts
+        T1CONbits.TCS = kExternalClk;
+        T1CONbits.TSYNC = kEnable; // synchronized to fcy, required for the period match
+        T1CONbits.TGATE = kDisable;
+        TMR1 = 0;
+        PR1 = edges - 1; // the match resets TMR1 on the next edge
+        t1_count_callback = callback;
+
+        IFS0bits.T1IF = 0;
+        IEC0bits.T1IE = kEnable;
+        T1CONbits.TON = kEnable;
+        return 1;
+}
+
+// gated accumulation: timer 1 counts fcy while T1CK is high. prescaler is the
+// TCKPS value. T1IF is set on every falling edge of the gate, so there is no
+// interrupt here, the caller keeps the high time of a window below 0x10000
+int gate_t1(unsigned char prescaler) {
+        T1CONbits.TON = kDisable;
+        IEC0bits.T1IE = kDisable;
+        t1_count_callback = 0;
+        if (!claim_t1ck()) {
+                return 0;
+        }
+
+        T1CONbits.TCKPS = prescaler;
+        T1CONbits.TCS = kInternalClk;
+        T1CONbits.TGATE = kEnable;
+        TMR1 = 0;
+        PR1 = 0xffff;
+        IFS0bits.T1IF = 0;
+        T1CONbits.TON = kEnable;
+        return 1;
+}
+
+uint16_t stop_t1(void) {
+        T1CONbits.TON = kDisable;
+        IEC0bits.T1IE = kDisable;
+        T1CONbits.TGATE = kDisable;
+        t1_count_callback = 0;
+        return TMR1;
+}
+
 void xmit_bit(int cycles_high, int cycles_low) {
         // reset timer
         TMR1 = 0;
@@ -86,6 +155,8 @@ void xmit_bit(int cycles_high, int cycles_low) {
 
 void xmit_samsung_signal(uint32_t msg) {
         NewClk(8); // button de-bounce uses 32kHz clock. this resets it
+        t1_count_callback = 0; // xmit_bit owns timer 1 now
+        T1CONbits.TCS = kInternalClk;
         TRISBbits.TRISB9 = 0; // enable pin output
         LATBbits.LATB9 = 0;
 
@@ -114,6 +185,10 @@ void xmit_samsung_signal(uint32_t msg) {
 // used for transmitting IR signals to samsung TVs
 void __attribute__((interrupt, no_auto_psv)) _T1Interrupt(void) {
         IFS0bits.T1IF = 0; // clear interrupt flag
+        if (t1_count_callback) {
+                t1_count_callback(); // counting edges, the timer keeps running
+                return;
+        }
         envelope_flag = 1;
         IEC0bits.T1IE = kDisable; // disable the interrup
         T1CONbits.TON = kDisable; // stops the timer
@@ -15,4 +15,17 @@ static uint32_t kVolumeDownBits = 0xe0e0d02f;
 void xmit_samsung_signal(uint32_t message); // message is one of the above unless you're an anarchist
 void delay_us_t1(uint16_t us); // temporary hack TODO
 
+/*
+ * T1CK is pin 10 == RA4 == CN0, the pin of the IR receiver (samsung_rx.c),
+ * BTN_CN0 (IO.c) and keypad column 0: only one of them can be wired to it. the
+ * T1CK counters refuse to start while RA4 is a registered CN pin, its pull up
+ * and interrupt would fight the comparator jumper
+ */
+#define T1CK_PORTA_MASK (1 << 4)
+
+// these return 0 if RA4 is taken
+int count_edges_t1(uint16_t edges, void (*callback)(void)); // T1CK edges, 0 edges stops
+int gate_t1(unsigned char prescaler); // fcy / prescaler counted while T1CK is high
+uint16_t stop_t1(void); // TMR1, after stopping either of the above
+
 #endif	/* IR_H */
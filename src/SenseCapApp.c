@@ -15,6 +15,7 @@
 // project files
 #include "ADC.h"
 #include "comparator.h"
+#include "dsp_filter.h"
 #include "misc.h"
 #include "Timer.h"
 
@@ -22,8 +23,9 @@
 #define MICRO 0.000001
 #define NANO 0.000000001
 #define PICO 0.000000000001
+#define OVERSAMPLE_BITS 2 // 16 conversions of the held voltage: 12 bit steps, big caps only
 
-//setup CTMU and ADC
+//setup CTMU, the ADC is set up per measurement
 void CTMUinit(){
         //Setting CTMU bits
         CTMUCONbits.TGEN = 0;           // disable edge time delay, also might cause current
@@ -33,8 +35,13 @@ void CTMUinit(){
         CTMUCONbits.CTTRIG = 0;         // disable trigger output
         CTMUCONbits.EDG1STAT = 0;       // EG1/2 turn current on if equal to one another
         CTMUCONbits.EDG2STAT = 0;       // see above ^
+}
 
-        //SETTING ADC BITS
+/**
+ * The ADC half of the setup, redone for every measurement: a stream or scan
+ * may have had the ADC in between. Only call it while holding kAdcCtmu
+ */
+static void ctmu_adc_setup(void) {
         AD1CHSbits.CH0NA = 0;
         AD1CHSbits.CH0SA = 0b1011;      // sets ADC ch0 sample A to pin 16 - AN11/RB13
         AD1CHSbits.CH0NB = 0;
@@ -101,7 +108,7 @@ void start_current_source(float current) {
 static double calc_voltage(float step_value) {
         static const float vref_plus = 3;   // Nathan's PC - 3.25;
         static const float vref_neg = 0.1f; // Noise measurements from breadboard
-        static const float max_step = 1023; // float to prevent truncation
+        static const float max_step = 1023 << OVERSAMPLE_BITS; // float to prevent truncation
         static const float real_ground = 0.05f; // measured ground
 
         return vref_neg + ((vref_plus - vref_neg) *
@@ -181,28 +188,51 @@ static inline long int us_to_cycles(float time_us) {
 }
 
 /**
- * Converts sampled value of ADC and discharges the capacitor
+ * Converts sampled value of ADC and discharges the capacitor. With the current
+ * off the capacitor holds its voltage, so it is converted 4^extra_bits times
+ * and decimated: the breadboard noise dithers the extra bits. A median of 3 in
+ * front keeps a single spiked conversion out of the sum. Every re-sample
+ * shares the charge with the ~4.4pF adc hold cap, so on the ~100pF small cap
+ * branch each one can pull the voltage down by a few percent: oversample
+ * only caps of a few nF and up, where that is below the extra bits
  * @param time_us - for capacitor discharging time
- * @return the ADC value (step_value) as integer
+ * @param extra_bits - 0 to OVERSAMPLE_BITS
+ * @return the ADC value (step_value) as integer, scaled to 10 + OVERSAMPLE_BITS
+ * bits whatever extra_bits was
  */
-static int sampleVoltage(float time_us){
+static int sampleVoltage(float time_us, unsigned char extra_bits){
         // turn off current
         CTMUCONbits.EDG2STAT = 0;       // 00 = current source is off
         CTMUCONbits.EDG1STAT = 0;       //    ^- as a combo ONLY
 
-        /*
-        * this does a lot:
-        *       - stop sampling input
-        *       - begin conversion
-        *       - 'hold' the capacitor value until set to 1 again
-        */
-        AD1CON1bits.SAMP = 0;
-
-        // wait for done bit
         static const int kADCDone = 1;
-        while (AD1CON1bits.DONE != kADCDone) {} // busy wait until conversion is complete
+        static const unsigned long kResampleCycles = 40; // 10us, the hold cap catches up
+        struct dsp_median spikes;
+        uint32_t sum = 0;
+        uint16_t i;
+
+        dsp_median_init(&spikes, 3);
+        for (i = 0; i < (1u << (2 * extra_bits)); i++) {
+                if (i) {
+                        AD1CON1bits.SAMP = 1; // sample the held voltage again
+                        __delay32(kResampleCycles);
+                }
+                AD1CON1bits.DONE = 0;
 
-        int step_value = ADC1BUF0 & 0x03ff; // stores last 10 bits of sample result
+                /*
+                * this does a lot:
+                *       - stop sampling input
+                *       - begin conversion
+                *       - 'hold' the capacitor value until set to 1 again
+                */
+                AD1CON1bits.SAMP = 0;
+
+                // wait for done bit
+                while (AD1CON1bits.DONE != kADCDone) {} // busy wait until conversion is complete
+
+                sum += dsp_median_update(&spikes, ADC1BUF0 & 0x03ff); // last 10 bits of sample result
+        }
+        int step_value = adc_decimate(sum, extra_bits) << (OVERSAMPLE_BITS - extra_bits);
 
         AD1CON1bits.SAMP = 1; // 1 = stop holding cap value
         CTMUCONbits.IDISSEN = 1; // discharge the capacitor during printing
@@ -217,6 +247,8 @@ static int sampleVoltage(float time_us){
  * capacitors the voltage will hit the rail, so decrease the current and time.
  * For low capacitors, if the voltage is below 1V, increment time and measure
  * again. For mid range capacitors, just calculate the capacitance.
+ * Takes the ADC from a running stream or scan for the measurement and gives
+ * it back before printing.
  */
 void sample_capacitance_adaptive(){
         float time_us = 5000; // test value to decide which current to use
@@ -226,11 +258,17 @@ void sample_capacitance_adaptive(){
         double expectedVoltageValue = 0.3f; // limiting value for lower caps
         double capacitance = 0;
 
+        if (!adc_claim(kAdcCtmu)) {
+                return;
+        }
+        ctmu_adc_setup();
+
         // adapt the current and time
-        // first measure one time
+        // first measure one time. a small cap droops under the re-samples but
+        // still lands far above expectedVoltageValue, its reading only picks the branch
         start_current_source(current_uA);
         __delay32(cycles);
-        int step_value = sampleVoltage(time_us);
+        int step_value = sampleVoltage(time_us, OVERSAMPLE_BITS);
         double voltage = calc_voltage(step_value);
 
         // change the current and measure again if needed
@@ -239,7 +277,7 @@ void sample_capacitance_adaptive(){
                 cycles = us_to_cycles(time_us);
                 start_current_source(current_uA);
                 __delay32(cycles);
-                int step_value = sampleVoltage(time_us);
+                int step_value = sampleVoltage(time_us, OVERSAMPLE_BITS);
                 double voltage2 = calc_voltage(step_value);
                 // calculate the capacitance with 2 different voltage values
                 capacitance = calc_capacitance(time_us, current_uA, (voltage2 - voltage));
@@ -249,7 +287,7 @@ void sample_capacitance_adaptive(){
                 cycles = us_to_cycles(time_us);
                 start_current_source(current_uA);
                 __delay32(cycles);
-                int step_value = sampleVoltage(time_us);
+                int step_value = sampleVoltage(time_us, 0);
                 voltage = calc_voltage(step_value);
                 // increase time until the voltage reaches 1V to avoid noise floor
                 while (voltage < 1) {
@@ -257,13 +295,14 @@ void sample_capacitance_adaptive(){
                         cycles = us_to_cycles(time_us);
                         start_current_source(current_uA);
                         __delay32(cycles);
-                        int step_value = sampleVoltage(time_us);
+                        int step_value = sampleVoltage(time_us, 0);
                         voltage = calc_voltage(step_value);
                 }
                 capacitance = calc_capacitance(time_us, current_uA, voltage);
         } else { // when the cap is around 1uF
                 capacitance = calc_capacitance(time_us, current_uA, voltage);
         }
+        adc_release(kAdcCtmu);
 
         print_results(voltage, capacitance);
 }
@@ -34,6 +34,7 @@
 #include <xc.h> // include processor files - each processor file is guarded.
 
 void CTMUinit();
+void sample_capacitance_adaptive(); // holds the adc while it measures
 
 #endif	/* SENSE_CAP_APP_H */
 
@@ -18,6 +18,17 @@ static char toggle_LED_in_t2interrupt = 0;
 static char toggle_LED_in_t3interrupt = 0;
 static char toggle_IR_in_t2interrupt = 0;
 static unsigned char repeat_timer = 0;
+static char t3_free_running = 0;
+static volatile uint32_t t3_base = 0; // timestamp at the last period match
+static uint16_t t3_period = 0; // PR3 + 1, 0 == 65536
+static char t2_oneshots = 0; // timer 2 serves the one shots below
+
+// one shots, all multiplexed onto timer 2. deadlines are timer 3 timestamps
+struct oneshot {
+	void (* callback)(void);
+	uint32_t deadline;
+};
+static struct oneshot oneshots[ONESHOT_SLOTS];
 
 // callback
 static void (* timer3_callback)(void); // my callback!
@@ -35,6 +46,7 @@ static inline void init_timer2(int frequency) {
 	NewClk(frequency); // Switch clock: 32 for 32kHz, 500 for 500 kHz, 8 for 8MHz
 
 	T2CONbits.T32 = kDisable; // one could combine timers 2 & 3 into 32 bit timer
+	t2_oneshots = 0; // the delay owns timer 2 now
 	T2CONbits.TCKPS = kDisable; // set pre-scaler (divides timer speed by );
 	T2CONbits.TCS = INTERNAL; // use internal clock (ie, not external)
 	T2CONbits.TSIDL = kDisable; // one could stop timer when processor idles
@@ -50,6 +62,8 @@ static inline void init_timer2_32(int frequency) {
 	NewClk(frequency); // Switch clock: 32 for 32kHz, 500 for 500 kHz, 8 for 8MHz
 
 	T2CONbits.T32 = kEnable; // one could combine timers 2 & 3 into 32 bit timer
+	t3_free_running = 0; // timer 3 is the upper half now
+	t2_oneshots = 0;
 	T2CONbits.TCKPS = kDisable; // set pre-scaler (divides timer speed by );
 	T2CONbits.TCS = INTERNAL; // use internal clock (ie, not external)
 	T2CONbits.TSIDL = kDisable; // one could stop timer when processor idles
@@ -165,6 +179,190 @@ void delay_us_32bit_cb(uint32_t us, void (*cb)()) {
 	delay_us_32bit(us);
 }
 
+// *********************************************************** timestamps & gaps
+// note: these don't call NewClk, they run off whatever clock is already set up
+void start_timestamp_t3(void) {
+	if (t3_free_running && T3CONbits.TON) {
+		return; // already running, restarting would move every deadline
+	}
+	T3CONbits.TON = kDisable;
+	T2CONbits.T32 = kDisable; // timer 3 runs on its own
+	T3CONbits.TCKPS = 0b01; // 1:8 pre-scaler, see TIMESTAMP_TICK_HZ
+	T3CONbits.TCS = INTERNAL; // use internal clock (ie, not external)
+	T3CONbits.TSIDL = kDisable; // keep counting while the processor idles
+	T3CONbits.TGATE = kDisable; // one could replace interrupts with an accumulator
+
+	timer3_callback = 0;
+	t3_base = 0;
+	t3_period = 0;
+	t3_free_running = 1;
+	TMR3 = 0;
+	PR3 = 0xffff; // wrap around, the interrupt extends it to 32 bit
+
+	IFS0bits.T3IF = 0;
+	IEC0bits.T3IE = kEnable;
+	T3CONbits.TON = kEnable;
+}
+
+uint32_t get_timestamp_t3(void) {
+	uint32_t base;
+	uint16_t low;
+
+	do {
+		base = t3_base;
+		low = TMR3;
+	} while (base != t3_base); // the period isr ran in between
+
+	// wrapped, but a higher priority isr kept the period from being counted yet
+	if (IFS0bits.T3IF && low <= (uint16_t)(t3_period - 1) >> 1) {
+		base += t3_period ? t3_period : 0x10000ul;
+	}
+
+	return base + low;
+}
+
+// the timestamp carries on across the change (less the few ticks timer 3 is
+// stopped for), the new period starts now. costs a T3 interrupt per period, so
+// keep it long unless something triggers off it
+void set_timestamp_period_t3(uint32_t ticks) {
+	start_timestamp_t3();
+	if (ticks < 2) {
+		ticks = 2;
+	}
+	if (ticks > 0x10000ul) {
+		ticks = 0x10000ul;
+	}
+
+	unsigned char ipl = SRbits.IPL;
+	SRbits.IPL = 7;
+	uint32_t now = get_timestamp_t3();
+	T3CONbits.TON = kDisable;
+	t3_base = now;
+	t3_period = (uint16_t)ticks; // 0x10000 wraps to 0
+	TMR3 = 0;
+	PR3 = (uint16_t)(ticks - 1);
+	IFS0bits.T3IF = 0;
+	T3CONbits.TON = kEnable;
+	SRbits.IPL = ipl;
+}
+
+// points timer 2 at the nearest deadline, or stops it. interrupts must be off
+static void program_oneshots(uint32_t now) {
+	uint32_t nearest = 0x10000; // a full lap of timer 2
+	unsigned char armed = 0;
+	unsigned char i;
+
+	T2CONbits.TON = kDisable;
+	for (i = 0; i < ONESHOT_SLOTS; i++) {
+		if (!oneshots[i].callback) {
+			continue;
+		}
+		int32_t left = oneshots[i].deadline - now;
+		if (left < 1) {
+			left = 1; // overdue, fire right away
+		}
+		if ((uint32_t)left < nearest) {
+			nearest = left;
+		}
+		armed = 1;
+	}
+
+	IFS0bits.T2IF = 0;
+	if (!armed) {
+		IEC0bits.T2IE = kDisable;
+		return;
+	}
+	TMR2 = 0;
+	PR2 = nearest - 1; // matches after PR2 + 1 ticks, longer waits take another lap
+	IEC0bits.T2IE = kEnable;
+	T2CONbits.TON = kEnable;
+}
+
+// runs the callbacks that are due, from the timer 2 isr
+static void run_oneshots(void) {
+	unsigned char ipl = SRbits.IPL;
+	unsigned char i;
+
+	for (i = 0; i < ONESHOT_SLOTS; i++) {
+		SRbits.IPL = 7; // the CN isr may (re)arm a slot meanwhile
+		void (*cb)(void) = oneshots[i].callback;
+		int due = cb && (int32_t)(oneshots[i].deadline - get_timestamp_t3()) <= 0;
+		if (due) {
+			oneshots[i].callback = 0; // one shot, the callback may re-arm it
+		}
+		SRbits.IPL = ipl;
+
+		if (due) {
+			cb();
+		}
+	}
+
+	SRbits.IPL = 7;
+	program_oneshots(get_timestamp_t3());
+	SRbits.IPL = ipl;
+}
+
+/*
+ * (re)starts a one shot on timer 2, same tick as the timestamps (needs
+ * start_timestamp_t3). each callback has its own deadline, up to ONESHOT_SLOTS
+ * of them run at the same time. calling it again with the same callback before
+ * it fires pushes the deadline back, which is how gaps are timed
+ */
+void arm_oneshot_t2(uint16_t ticks, void (*cb)(void)) {
+	unsigned char ipl = SRbits.IPL;
+	unsigned char i;
+	struct oneshot *slot = 0;
+
+	SRbits.IPL = 7; // callers run at several priorities
+	if (!t2_oneshots) {
+		T2CONbits.TON = kDisable;
+		T2CONbits.T32 = kDisable; // one could combine timers 2 & 3 into 32 bit timer
+		T2CONbits.TCKPS = 0b01; // 1:8 pre-scaler, see TIMESTAMP_TICK_HZ
+		T2CONbits.TCS = INTERNAL; // use internal clock (ie, not external)
+		T2CONbits.TSIDL = kDisable; // one could stop timer when processor idles
+		T2CONbits.TGATE = kDisable; // one could replace interrupts with an accumulator
+		timer2_callback = 0;
+		for (i = 0; i < ONESHOT_SLOTS; i++) {
+			oneshots[i].callback = 0;
+		}
+		t2_oneshots = 1;
+	}
+
+	for (i = 0; i < ONESHOT_SLOTS; i++) {
+		if (oneshots[i].callback == cb) {
+			slot = &oneshots[i];
+			break;
+		}
+		if (!slot && !oneshots[i].callback) {
+			slot = &oneshots[i]; // keep looking for cb itself
+		}
+	}
+
+	if (slot) {
+		uint32_t now = get_timestamp_t3();
+		slot->callback = cb;
+		slot->deadline = now + ticks;
+		program_oneshots(now);
+	}
+	SRbits.IPL = ipl;
+}
+
+// frees cb's slot if it is still pending, nothing happens if it is not
+void cancel_oneshot_t2(void (*cb)(void)) {
+	unsigned char ipl = SRbits.IPL;
+	unsigned char i;
+
+	SRbits.IPL = 7;
+	for (i = 0; t2_oneshots && i < ONESHOT_SLOTS; i++) {
+		if (oneshots[i].callback == cb) {
+			oneshots[i].callback = 0;
+			program_oneshots(get_timestamp_t3());
+			break;
+		}
+	}
+	SRbits.IPL = ipl;
+}
+
 // *********************************************************** interrupt handler
 void __attribute__((interrupt, no_auto_psv)) _T2Interrupt(void) {
 	IFS0bits.T2IF = 0; // clear flag
@@ -174,6 +372,11 @@ void __attribute__((interrupt, no_auto_psv)) _T2Interrupt(void) {
 	IEC0bits.T2IE = kDisable; // stop the interrupt
         // }
 
+	if (t2_oneshots) {
+		run_oneshots();
+		return;
+	}
+
         if (timer2_callback) {
 		timer2_callback();
         }
@@ -182,6 +385,11 @@ void __attribute__((interrupt, no_auto_psv)) _T2Interrupt(void) {
 void __attribute__((interrupt, no_auto_psv)) _T3Interrupt(void) {
 	IFS0bits.T3IF = 0; // disable interrupt
 
+	if (t3_free_running) {
+		t3_base += t3_period ? t3_period : 0x10000ul; // timestamp timer keeps running
+		return;
+	}
+
 	T2CONbits.TON = kDisable; // stop the timer
 	IEC0bits.T3IE = kDisable; // stop the interrupt
 
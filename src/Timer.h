@@ -7,6 +7,8 @@
 // globals
 #define MS_PER_S 1000
 #define US_PER_S 1000000
+#define TIMESTAMP_TICK_HZ 500000UL // 8MHz clock: fcy = 4MHz, 1:8 pre-scaler
+#define ONESHOT_SLOTS 4 // one shots that can be armed at the same time
 
 // wraps delay_ms to enable LED flickering
 void set_LED_toggles_on_t2interrupt(unsigned char perform_toggles);
@@ -19,6 +21,13 @@ void delay_us_32bit(uint32_t us);
 void delay_us_32bit_cb(uint32_t us, void (* timer3_callback)(void));
 void delay_us_500(uint16_t us);
 
+// free running 32 bit timestamps on timer 3, one shot (gap) timer on timer 2
+void start_timestamp_t3(void);
+uint32_t get_timestamp_t3(void);
+void set_timestamp_period_t3(uint32_t ticks); // 2 to 65536, the T3 match can trigger the adc
+void arm_oneshot_t2(uint16_t ticks, void (* timer2_callback)(void));
+void cancel_oneshot_t2(void (* timer2_callback)(void));
+
 void __attribute__ ((interrupt, no_auto_psv)) _T2Interrupt(void); // interrupt handler
 
 #endif
@@ -4,6 +4,22 @@
 
 unsigned int clkval;
 
+// background transmit, the TX interrupt feeds the fifo from here
+static const unsigned char *volatile tx_next = 0;
+static volatile unsigned int tx_left = 0;
+
+// BRGH = 1: baud = fcy / (4 * (brg + 1)). 115200 would be 3.5% off
+static const struct {
+    unsigned long baud;
+    unsigned int brg;
+} kBauds[UART2_BAUDS] = {
+    {9600, 103},    // +0.16%
+    {19200, 51},    // +0.16%
+    {38400, 25},    // +0.16%
+    {57600, 16},    // +2.1%
+    {76800, 12},    // +0.16%
+};
+
 ///// Initialization of UART 2 module.
 
 void InitUART2(void)
@@ -111,6 +127,11 @@ void __attribute__ ((interrupt, no_auto_psv)) _U2RXInterrupt(void) {
 }
 void __attribute__ ((interrupt, no_auto_psv)) _U2TXInterrupt(void) {
 	IFS1bits.U2TXIF = 0;
+	// the fifo went empty (UTXISEL 10), top it up
+	while (tx_left && !U2STAbits.UTXBF) {
+		U2TXREG = *tx_next++;
+		tx_left--;
+	}
 //	if(U2STAbits.TRMT==1)		//Turn off UART2 upon transmission of last character
 //	{
 //		U2MODEbits.UARTEN = 0;
@@ -178,11 +199,25 @@ void Disp2Hex32(unsigned long int DispData32)   // Displays 32 bit number in Hex
 }
 
 
-void Disp2Dec(unsigned int DispData)
+void Disp2Dec(unsigned int DispData)   // Displays 16 bit number in decimal form using UART2
 {
-  //  XmitUART2(' ',1);  // Disp Gap
-  //  XmitUART2(DispData + 0x30 ,1);
-  //  return;
+    char digits[5];
+    unsigned char i = 0;
+    XmitUART2(' ',1);  // Disp Gap
+
+    do
+    {
+        digits[i++] = (DispData % 10) + 0x30;  // least significant digit first
+        DispData = DispData / 10;
+    } while (DispData != 0);
+
+    while (i > 0)
+    {
+        XmitUART2(digits[--i],1);
+    }
+
+    XmitUART2(' ',1);
+    return;
 }
 
 
@@ -201,3 +236,64 @@ void Disp2String(char *str) //Displays String of characters
 
     return;
 }
+
+
+
+unsigned long UART2BaudAt(unsigned char index)
+{
+    return index < UART2_BAUDS ? kBauds[index].baud : 0;
+}
+
+
+int InitUART2Baud(unsigned long baud)  // stays on until the next XmitUART2
+{
+    unsigned char i;
+
+    for (i = 0; i < UART2_BAUDS && kBauds[i].baud != baud; i++) {}
+    if (i == UART2_BAUDS)
+    {
+        return 0;
+    }
+
+    InitUART2();
+    U2MODEbits.UARTEN = 0;
+    U2STAbits.UTXISEL1 = 1;  // 10: interrupt when the fifo goes empty. InitUART2
+    U2STAbits.UTXISEL0 = 0;  // leaves 11, which is reserved on this part
+    U2BRG = kBauds[i].brg;
+    U2MODEbits.UARTEN = 1;
+    U2STAbits.UTXEN = 1;
+    return 1;
+}
+
+
+int XmitUART2Async(const void *data, unsigned int count)   // data has to stay put until sent
+{
+    if (tx_left)
+    {
+        return 0;
+    }
+
+    unsigned char ipl = SRbits.IPL;
+    SRbits.IPL = 7;  // the TX interrupt takes over once the fifo is full
+    tx_next = data;
+    tx_left = count;
+    while (tx_left && !U2STAbits.UTXBF)
+    {
+        U2TXREG = *tx_next++;
+        tx_left--;
+    }
+    SRbits.IPL = ipl;
+    return 1;
+}
+
+
+int UART2TxBusy(void)  // the buffer can be reused once this is 0
+{
+    return tx_left != 0;
+}
+
+
+void UART2TxFlush(void)  // the last bytes may still be in the fifo and the shift register
+{
+    while (tx_left || !U2STAbits.TRMT) {}
+}
@@ -22,6 +22,15 @@ extern "C" {
 void InitUART2(void);
 void XmitUART2(char, unsigned int);
 
+// background transmit at 8MHz (fcy 4MHz). XmitUART2 and the Disp2 calls go
+// back to 9600 and switch the uart off when done, don't mix them with these
+#define UART2_BAUDS 5
+unsigned long UART2BaudAt(unsigned char index); // the supported rates, 0 past the end
+int InitUART2Baud(unsigned long baud); // 0 if not in the table
+int XmitUART2Async(const void *data, unsigned int count); // 0 while a buffer is going out
+int UART2TxBusy(void);
+void UART2TxFlush(void); // until the last stop bit is out, before the uart is reset
+
 void __attribute__ ((interrupt, no_auto_psv)) _U2RXInterrupt(void);
 void __attribute__ ((interrupt, no_auto_psv)) _U2TXInterrupt(void); 
 
@@ -0,0 +1,149 @@
+// adc_uart.c
+
+// libraries & header
+#include "adc_uart.h"
+
+// project files
+#include "ADC.h"
+#include "Timer.h"
+#include "UART2.h"
+
+// Magic Numbers
+static const uint8_t kSync0 = 0xa5;
+static const uint8_t kSync1 = 0x5a;
+
+// statics, main loop only: the isrs behind them have their own queues
+static struct adc_uart_packet packets[2];
+static unsigned char filling = 0; // the other one may be on the wire
+static unsigned char waiting = 0; // filling is full, the wire is still busy
+static uint8_t skipped = 0; // samples thrown away since the last drop was counted
+static unsigned char running = 0;
+static uint8_t sequence = 0;
+static uint32_t started = 0;
+static uint16_t adc_dropped_before = 0; // the adc counts since power up
+static struct adc_uart_stats stats;
+
+
+
+// ************************************************************ helper functions
+static void begin_packet(void) {
+        struct adc_uart_packet *p = &packets[filling];
+
+        p->sync[0] = kSync0;
+        p->sync[1] = kSync1;
+        p->sequence = sequence;
+        p->count = 0;
+}
+
+// a full packet goes out as soon as the link is free. until then it waits and
+// what the adc delivers meanwhile is thrown away, in packets' worth: the one
+// on the wire and the one waiting must not be touched
+static void send_packet(void) {
+        if (!XmitUART2Async(&packets[filling], sizeof(packets[filling]))) {
+                waiting = 1;
+                return;
+        }
+        waiting = 0;
+        stats.sent += ADC_UART_SAMPLES;
+        sequence++;
+        if (skipped) {
+                stats.dropped++; // a partly skipped packet counts too
+                sequence++;
+                skipped = 0;
+        }
+        filling ^= 1;
+        begin_packet();
+}
+
+static void skip_sample(void) {
+        if (++skipped == ADC_UART_SAMPLES) {
+                stats.dropped++;
+                sequence++;
+                skipped = 0;
+        }
+}
+
+
+
+// *************************************************************** API functions
+int adc_uart_start(unsigned char channel, uint16_t rate_hz, unsigned long baud) {
+        struct adc_acq_config config = {channel, 31, 7, rate_hz};
+        struct adc_acq_stats adc;
+        struct adc_block block;
+
+        if (!InitUART2Baud(baud)) {
+                return 0;
+        }
+        while (adc_get_block(&block)) {} // left over from an earlier run
+        if (!adc_acq_start(&config)) {
+                return 0;
+        }
+
+        stats.acquired = 0;
+        stats.sent = 0;
+        stats.dropped = 0;
+        stats.adc_dropped = 0;
+        stats.sent_per_s = 0;
+        adc_acq_get_stats(&adc);
+        adc_dropped_before = adc.dropped;
+        sequence = 0;
+        filling = 0;
+        waiting = 0;
+        skipped = 0;
+        begin_packet();
+        started = get_timestamp_t3();
+        running = 1;
+        return 1;
+}
+
+void adc_uart_poll(void) {
+        struct adc_uart_packet *p;
+        struct adc_block block;
+        unsigned char i;
+
+        if (!running) {
+                return;
+        }
+        if (waiting) {
+                send_packet();
+        }
+        while (adc_get_block(&block)) {
+                for (i = 0; i < ADC_BLOCK; i++) {
+                        if (waiting) {
+                                send_packet(); // the link may have freed up mid block
+                        }
+                        if (waiting) {
+                                skip_sample();
+                                continue;
+                        }
+                        p = &packets[filling];
+                        p->samples[p->count++] = block.samples[i];
+                        if (p->count == ADC_UART_SAMPLES) {
+                                send_packet();
+                        }
+                }
+                stats.acquired += ADC_BLOCK;
+        }
+}
+
+void adc_uart_stop(void) {
+        struct adc_acq_stats adc;
+        uint32_t elapsed;
+
+        if (!running) {
+                return;
+        }
+        elapsed = get_timestamp_t3() - started;
+        adc_acq_get_stats(&adc);
+        adc_acq_stop();
+        running = 0;
+        UART2TxFlush(); // the next Disp2 call resets the uart, fifo and all
+
+        stats.adc_dropped = adc.dropped - adc_dropped_before;
+        stats.sent_per_s = elapsed ? (uint64_t)stats.sent * TIMESTAMP_TICK_HZ / elapsed : 0;
+}
+
+// the rate is filled in by adc_uart_stop, the counts are live
+void adc_uart_get_stats(struct adc_uart_stats *out) {
+        *out = stats;
+}
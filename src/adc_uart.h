@@ -0,0 +1,41 @@
+// adc_uart.h
+#ifndef ADC_UART_H
+#define ADC_UART_H
+
+#include <stdint.h>
+
+/*
+ * adc samples out of the uart while the next ones come in. the adc interrupt
+ * queues blocks as always, the main loop packs them into one of two packets
+ * while the uart interrupt sends the other. a packet that fills up while the
+ * other is still going out waits for the link, and samples that come in
+ * meanwhile are thrown away: acquisition never waits for the link, and the
+ * link only waits for a packet when the adc is the slower of the two.
+ * packets are binary:
+ *   0xa5 0x5a, sequence (counts dropped packets too), sample count,
+ *   then the samples as 16 bit little endian
+ */
+#define ADC_UART_SAMPLES 32 // per packet, 68 bytes with the header
+
+struct adc_uart_packet {
+        uint8_t sync[2];
+        uint8_t sequence;
+        uint8_t count;
+        uint16_t samples[ADC_UART_SAMPLES];
+};
+
+struct adc_uart_stats {
+        uint32_t acquired;      // samples taken from the adc
+        uint32_t sent;          // samples handed to the uart
+        uint16_t dropped;       // packets' worth of samples the link had no time for
+        uint16_t adc_dropped;   // blocks the adc queue lost, the main loop was late
+        uint16_t sent_per_s;    // sustained, since the start
+};
+
+// takes the adc (timer 3 triggered at rate_hz) and the uart at baud
+int adc_uart_start(unsigned char channel, uint16_t rate_hz, unsigned long baud);
+void adc_uart_poll(void); // main loop, never blocks
+void adc_uart_stop(void); // lets the packet in flight finish
+void adc_uart_get_stats(struct adc_uart_stats *stats);
+
+#endif
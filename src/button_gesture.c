@@ -0,0 +1,200 @@
+
+// libraries & header
+#include <stdint.h>
+#include "button_gesture.h"
+#include "spsc_queue.h"
+#include "Timer.h" // for TIMESTAMP_TICK_HZ
+
+#define EVENT_QUEUE_SIZE 8 // power of two
+#define MS_TO_TICKS(ms) ((uint32_t)(ms) * (TIMESTAMP_TICK_HZ / MS_PER_S))
+
+// constants
+static const struct gesture_config kDefaultConfig = {
+	50,     // chord_ms
+	1000,   // long_press_ms
+	300,    // double_click_ms
+	0,      // repeat_delay_ms, off
+	100,    // repeat_interval_ms
+};
+
+// timings in timer ticks
+static uint32_t chord_ticks;
+static uint32_t long_press_ticks;
+static uint32_t double_click_ticks;
+static uint32_t repeat_delay_ticks;
+static uint32_t repeat_interval_ticks;
+
+// per button
+static uint32_t down_since[kButtonCount];
+static uint32_t released_at[kButtonCount];
+static uint32_t repeat_at[kButtonCount]; // hold time of the next repeat
+static uint16_t pressed = 0;
+static uint16_t pending = 0;            // pressed, press not reported yet
+static uint32_t pending_since = 0;
+static uint16_t in_chord = 0;           // no long press / repeat / double click
+static uint16_t doubled = 0;            // this hold is the second click
+static uint16_t long_sent = 0;
+static uint16_t can_double = 0;         // released_at is valid
+
+// events for the main loop
+SPSC_QUEUE(gesture, struct gesture_event, EVENT_QUEUE_SIZE)
+static struct gesture_queue events;
+
+
+
+// ************************************************************ helper functions
+static void emit(enum GESTURE_TYPE type, uint16_t buttons, uint32_t timestamp) {
+	struct gesture_event event = {type, buttons, timestamp};
+	gesture_push(&events, &event); // counts a drop if the main loop fell behind
+}
+
+static unsigned char single_button(uint16_t mask) {
+	unsigned char i = 0;
+	while (!(mask & 1)) {
+		mask >>= 1;
+		i++;
+	}
+	return i;
+}
+
+// the chord window closed (or a button let go): report what was held back
+static void flush_pending(void) {
+	if (!pending) {
+		return;
+	}
+
+	if (pending & (pending - 1)) {
+		in_chord |= pending;
+		emit(kGestureChord, pending, pending_since);
+	} else {
+		unsigned char i = single_button(pending);
+		if ((can_double & pending) && double_click_ticks
+				&& down_since[i] - released_at[i] < double_click_ticks) {
+			doubled |= pending; // a third click starts over
+			emit(kGestureDoubleClick, pending, pending_since);
+		} else {
+			emit(kGesturePress, pending, pending_since);
+		}
+	}
+	pending = 0;
+}
+
+static void check_held(unsigned char i, uint32_t now) {
+	uint16_t mask = BUTTON_MASK(i);
+	uint32_t held = now - down_since[i];
+
+	if (long_press_ticks && !(long_sent & mask) && held >= long_press_ticks) {
+		long_sent |= mask;
+		emit(kGestureLongPress, mask, down_since[i]);
+	}
+	if (repeat_delay_ticks && held >= repeat_at[i]) {
+		repeat_at[i] += repeat_interval_ticks;
+		emit(kGestureRepeat, mask, now);
+	}
+}
+
+
+
+// *************************************************************** API functions
+void gesture_init(const struct gesture_config *config) {
+	if (!config) {
+		config = &kDefaultConfig;
+	}
+	chord_ticks = MS_TO_TICKS(config->chord_ms);
+	long_press_ticks = MS_TO_TICKS(config->long_press_ms);
+	double_click_ticks = MS_TO_TICKS(config->double_click_ms);
+	repeat_delay_ticks = MS_TO_TICKS(config->repeat_delay_ms);
+	repeat_interval_ticks = MS_TO_TICKS(config->repeat_interval_ms);
+	if (!repeat_interval_ticks) {
+		repeat_delay_ticks = 0; // repeating with no interval makes no sense
+	}
+
+	pressed = 0;
+	pending = 0;
+	in_chord = 0;
+	doubled = 0;
+	long_sent = 0;
+	can_double = 0;
+}
+
+/*
+ * call with the debounced buttons (buttons_pressed()) and a timer 3 timestamp
+ * after every debounce sample, and keep calling it while gesture_busy(): long
+ * presses, repeats and the chord window are decided by time, not by edges.
+ * never waits, so it is safe from an isr
+ */
+void gesture_update(uint16_t now_pressed, uint32_t now) {
+	uint16_t just_pressed = now_pressed & ~pressed;
+	uint16_t just_released = pressed & ~now_pressed;
+	unsigned char i;
+
+	pressed = now_pressed;
+
+	if (pending && now - pending_since >= chord_ticks) {
+		flush_pending();
+	}
+
+	if (just_pressed) {
+		for (i = 0; i < kButtonCount; i++) {
+			if (just_pressed & BUTTON_MASK(i)) {
+				down_since[i] = now;
+				repeat_at[i] = repeat_delay_ticks;
+			}
+		}
+		long_sent &= ~just_pressed;
+		if (!pending) {
+			pending_since = now;
+		}
+		pending |= just_pressed; // joins the chord window, if one is open
+		if (!chord_ticks) {
+			flush_pending();
+		}
+	}
+
+	if (just_released) {
+		if (pending & just_released) {
+			flush_pending(); // a quick tap is still a press
+		}
+		for (i = 0; i < kButtonCount; i++) {
+			if (just_released & BUTTON_MASK(i)) {
+				released_at[i] = now;
+			}
+		}
+		can_double = (can_double | just_released) & ~in_chord & ~doubled;
+		in_chord &= ~just_released;
+		doubled &= ~just_released;
+		emit(kGestureRelease, just_released, now);
+	}
+
+	uint16_t held = pressed & ~pending & ~in_chord;
+	for (i = 0; held; i++, held >>= 1) {
+		if (held & 1) {
+			check_held(i, now);
+		}
+	}
+}
+
+// nonzero while time alone can still produce an event
+uint16_t gesture_busy(void) {
+	return pressed | pending;
+}
+
+// only call from the main loop
+int gesture_get_event(struct gesture_event *event) {
+	return gesture_pop(&events, event);
+}
+
+uint16_t gesture_dropped(void) {
+	return events.dropped;
+}
+
+uint8_t gesture_high_water(void) {
+	return events.high_water;
+}
+
+const char *gesture_name(enum GESTURE_TYPE type) {
+	static const char *const kNames[kGestureTypeCount] = {
+		"press", "release", "long press", "double click", "chord", "repeat"
+	};
+	return type < kGestureTypeCount ? kNames[type] : "?";
+}
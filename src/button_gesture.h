@@ -0,0 +1,40 @@
+#ifndef BUTTON_GESTURE_H
+#define BUTTON_GESTURE_H
+
+#include <stdint.h>
+#include "button_state.h"
+
+enum GESTURE_TYPE {
+	kGesturePress = 0,
+	kGestureRelease,
+	kGestureLongPress,      // once per hold, after long_press_ms
+	kGestureDoubleClick,    // replaces the press of the second click
+	kGestureChord,          // buttons pressed within chord_ms, replaces their presses
+	kGestureRepeat,         // every repeat_interval_ms after repeat_delay_ms
+	kGestureTypeCount
+};
+
+struct gesture_event {
+	enum GESTURE_TYPE type;
+	uint16_t buttons;       // BUTTON_MASK() bits, several for a chord
+	uint32_t timestamp;     // timer 3 ticks, when the gesture started
+};
+
+// in ms, 0 turns the gesture off
+struct gesture_config {
+	uint16_t chord_ms;              // presses are held back this long
+	uint16_t long_press_ms;
+	uint16_t double_click_ms;       // release to next press
+	uint16_t repeat_delay_ms;
+	uint16_t repeat_interval_ms;
+};
+
+void gesture_init(const struct gesture_config *config); // 0 = defaults
+void gesture_update(uint16_t pressed, uint32_t now);
+uint16_t gesture_busy(void);
+int gesture_get_event(struct gesture_event *event);
+uint16_t gesture_dropped(void);
+uint8_t gesture_high_water(void);
+const char *gesture_name(enum GESTURE_TYPE type);
+
+#endif
@@ -2,108 +2,96 @@
 // libraries & header
 #include <stdint.h>
 #include "button_state.h"
+#include "xc.h"
 
-// other
-#include "UART2.h" // just for debugging
+enum PORT_NAME {kPortA, kPortB, kPortCount};
+
+struct button_pin {
+	enum PORT_NAME port;
+	uint16_t mask;
+};
+
+// one entry per BUTTON_NAME. all buttons use pull ups, so pressed reads 0
+static const struct button_pin kButtonPins[kButtonCount] = {
+	[BTN_CN0] = {kPortA, 1 << 4}, // pin 10 == RA4 == CN0
+	[BTN_CN1] = {kPortB, 1 << 4}, // pin 9 == RB4 == CN1
+	[BTN_CN8] = {kPortA, 1 << 6}, // pin 14 == RA6 == CN8
+};
 
 // Static variables
-static unsigned int CN0_val = 0;
-static unsigned int CN1_val = 0;
-static unsigned int CN8_val = 0;
-
-// ************************************************************ helper functions
-enum BUTTON_STATE get_CN0_state(unsigned char current_val) {
-	unsigned char prev_val = CN0_val;
-	unsigned char combined_val = (prev_val << 1) + current_val;
-	CN0_val = current_val;
-
-	// note: 2 bits, first is prev, second is current. Enums defined in this way in header
-	switch (combined_val) {
-	case kJustPressed:
-		return kJustPressed;
-		break;
-	case kPressed:
-		return kPressed;
-		break;
-	case kJustReleased:
-		return kJustReleased;
-		break;
-	case kNotPressed:
-		return kNotPressed;
-		break;
-	default:
-		return 0; // should never get here
-		XmitUART2('q',2); // just to give a hint something happened
-	}
+static struct debouncer buttons = {0xffff, 0xffff, 0, 0, 0};
+
+
+
+// ************************************************************ core functions
+void debouncer_init(struct debouncer *db, uint16_t state) {
+	db->cnt0 = 0xffff; // counters start at 3 and count down
+	db->cnt1 = 0xffff;
+	db->state = state;
+	db->just_pressed = 0;
+	db->just_released = 0;
 }
 
-static enum BUTTON_STATE get_CN1_state(unsigned char current_val) {
-	unsigned char prev_val = CN1_val;
-	unsigned char combined_val = (prev_val << 1) + current_val;
-	CN1_val = current_val;
-
-	// note: 2 bits, first is prev, second is current. Enums defined in this way in header
-	switch (combined_val) {
-	case kJustPressed:
-		return kJustPressed;
-		break;
-	case kPressed:
-		return kPressed;
-		break;
-	case kJustReleased:
-		return kJustReleased;
-		break;
-	case kNotPressed:
-		return kNotPressed;
-		break;
-	default:
-		return 0; // should never get here
-		XmitUART2('r',2); // just to give a hint something happened
-	}
+// takes a packed sample (1 = pressed), returns the mask of buttons that changed
+uint16_t debouncer_update(struct debouncer *db, uint16_t sample) {
+	uint16_t differs = sample ^ db->state;
+
+	// count down where the sample differs, reload to 3 where it agrees
+	db->cnt0 = ~(db->cnt0 & differs);
+	db->cnt1 = db->cnt0 ^ (db->cnt1 & differs);
+
+	// counter wrapped past 0: 4 disagreeing samples in a row
+	uint16_t toggle = differs & db->cnt0 & db->cnt1;
+	db->state ^= toggle;
+	db->just_pressed = db->state & toggle;
+	db->just_released = ~db->state & toggle;
+	return toggle;
 }
 
-enum BUTTON_STATE get_CN8_state(unsigned char current_val) {
-	unsigned char prev_val = CN8_val;
-	unsigned char combined_val = (prev_val << 1) + current_val;
-	CN8_val = current_val;
-
-	// note: 2 bits, first is prev, second is current. Enums defined in this way in header
-	switch (combined_val) {
-	case kJustPressed:
-		return kJustPressed;
-		break;
-	case kPressed:
-		return kPressed;
-		break;
-	case kJustReleased:
-		return kJustReleased;
-		break;
-	case kNotPressed:
-		return kNotPressed;
-		break;
-	default:
-		return 0; // should never get here
-		XmitUART2('q',2); // just to give a hint something happened
+
+
+// *************************************************************** API functions
+// reads every port once and packs the buttons, bit n = BUTTON_NAME n
+uint16_t buttons_sample(void) {
+	uint16_t ports[kPortCount];
+	uint16_t sample = 0;
+	unsigned char i;
+
+	ports[kPortA] = PORTA;
+	ports[kPortB] = PORTB;
+	for (i = 0; i < kButtonCount; i++) {
+		if (!(ports[kButtonPins[i].port] & kButtonPins[i].mask)) {
+			sample |= BUTTON_MASK(i);
+		}
 	}
+	return sample;
 }
 
-// ************************************************************ core functions
-enum BUTTON_STATE get_button_state(enum BUTTON_NAME button, unsigned char value) {
-	enum BUTTON_STATE state;
-	switch(button) {
-	case BTN_CN0:
-		state = get_CN0_state(value);
-		break;
-	case BTN_CN1:
-		state = get_CN1_state(value);
-		break;
-    case BTN_CN8:
-		state = get_CN8_state(value);
-		break;
-	default:
-		state = 0; // should never get here
-		XmitUART2('m', 1);
-	}
+uint16_t buttons_update(void) {
+	return debouncer_update(&buttons, buttons_sample());
+}
+
+uint16_t buttons_pressed(void) {
+	return buttons.state;
+}
+
+uint16_t buttons_just_pressed(void) {
+	return buttons.just_pressed;
+}
+
+uint16_t buttons_just_released(void) {
+	return buttons.just_released;
+}
+
+// buttons whose counter is running, ie the last sample disagreed with the state
+uint16_t buttons_settling(void) {
+	return ~(buttons.cnt0 & buttons.cnt1);
+}
 
-	return state;
+// note: 2 bits, first is prev, second is current. Enums defined in this way in header
+enum BUTTON_STATE get_button_state(enum BUTTON_NAME button) {
+	uint16_t mask = BUTTON_MASK(button);
+	unsigned char current = (buttons.state & mask) != 0;
+	unsigned char changed = ((buttons.just_pressed | buttons.just_released) & mask) != 0;
+	return (enum BUTTON_STATE)(((current ^ changed) << 1) | current);
 }
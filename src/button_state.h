@@ -9,8 +9,34 @@ enum BUTTON_STATE {
 	kPressed = 0b11,
 	kJustReleased = 0b10
 };
-enum BUTTON_NAME {BTN_CN0, BTN_CN1, BTN_CN8};
 
-enum BUTTON_STATE get_button_state(enum BUTTON_NAME, unsigned char);
+// bit position in the packed masks, add a pin to kButtonPins in button_state.c too
+enum BUTTON_NAME {BTN_CN0, BTN_CN1, BTN_CN8, kButtonCount};
+#define BUTTON_MASK(button) ((uint16_t)1 << (button))
+
+/*
+ * vertical counter debouncer: bit n of every field belongs to button n, so up
+ * to 16 buttons are debounced with the same handful of instructions. a button
+ * changes state after 4 samples in a row disagree with its debounced state
+ */
+struct debouncer {
+	uint16_t cnt0;          // low bits of the per button 2 bit counters
+	uint16_t cnt1;          // high bits
+	uint16_t state;         // debounced, 1 = pressed
+	uint16_t just_pressed;  // edges found by the last update
+	uint16_t just_released;
+};
+
+void debouncer_init(struct debouncer *db, uint16_t state);
+uint16_t debouncer_update(struct debouncer *db, uint16_t sample);
+
+// the board buttons
+uint16_t buttons_sample(void);
+uint16_t buttons_update(void);
+uint16_t buttons_pressed(void);
+uint16_t buttons_just_pressed(void);
+uint16_t buttons_just_released(void);
+uint16_t buttons_settling(void);
+enum BUTTON_STATE get_button_state(enum BUTTON_NAME button);
 
 #endif
@@ -5,40 +5,406 @@
 // project files
 #include "UART2.h"
 #include "button_state.h"
+#include "cvref.h"
+#include "IR.h" // timer 1 edge counter
+#include "Timer.h"
+
+#define MS_TO_TICKS(ms) ((uint32_t)(ms) * (TIMESTAMP_TICK_HZ / MS_PER_S))
 
 static volatile unsigned int count = 0;
 int volatile countTarget = 0;
+static volatile enum DIVIDER_MODE divider_mode = kDividerIsr;
+
+static const uint16_t kWindowPollTicks = MS_TO_TICKS(1); // in band, the far edge is checked this often
+static const uint16_t kTrackPollTicks = MS_TO_TICKS(20); // no crossing for this long: step towards the input
+static const uint16_t kTrackStepMv = 10;
+static const uint16_t kMaxThresholdMv = 2400; // top of the ladder at 3.3V
+static const unsigned long kSettleCycles = 40; // 10us at fcy 4MHz, CVREF after a code change
+
+// thresholds: the comparator isr owns everything below once configured
+static volatile enum CMP_MODE cmp_mode = kCmpSingle;
+static struct cmp_config cmp;
+static unsigned char configured = 0; // cmp has thresholds in it
+static uint8_t low_code = 0;
+static uint8_t high_code = 0;
+static volatile unsigned char armed_high = 1; // which threshold CVREF sits at
+static volatile unsigned char level = 0; // input above the armed threshold
+static volatile enum CMP_BAND band = kBandBelow;
+static uint32_t last_crossing = 0;
+static uint32_t glitch_ticks = 0;
+static uint32_t time_high = 0; // per period, for tracking
+static uint32_t time_low = 0;
+static unsigned char crossed_since_poll = 0;
+static volatile unsigned char poll_pending = 0;
+static volatile uint32_t cmp_events = 0;
+static volatile uint32_t cmp_crossings = 0;
+static volatile uint32_t cmp_spurious = 0;
+static cmp_crossing_handler crossing_handler = 0;
+
+// frequency measurement: the isr counts and timestamps, the gate timer closes.
+// both are interrupts, the gate one holds CMIE off while it touches the counts
+static struct freq_counter meter;
+static volatile unsigned char freq_running = 0;
+static volatile unsigned char freq_ready = 0;
 
 
 
 // *********************************************************************** cvref
 void CVREFinit (float vref) {
-        // clamp Vref between 0 and 2.37
+        // clamp Vref between 0 and 5V, then the nearest (calibrated) code
         if (vref < 0 ) {
             vref = 0;
         }
 
-        if (vref > 2.37) {
-            vref = 2.37;
+        if (vref > 5.0f) {
+            vref = 5.0f;
+        }
+
+        cvref_set_mv((uint16_t)(vref * 1000)); // integer from here on, see cvref.h
+        CVRCONbits.CVROE = 1; // vref output enable (pin 17)
+}
+
+
+
+// ********************************************************************* divider
+static void divider_toggle(void) {
+        LATBbits.LATB9 = !LATBbits.LATB9;
+}
+
+// the isr counts both edges of a period, timer 1 only the rising one
+static uint16_t timer_edges(int target) {
+        return target > 1 ? (target + 1) / 2 : 1;
+}
+
+// the comparator interrupt stays on for the isr divider, the frequency meter,
+// the threshold modes and a crossing handler
+static void update_comparator_interrupt(void) {
+        IEC1bits.CMIE = divider_mode == kDividerIsr || freq_running || cmp_mode != kCmpSingle
+                        || crossing_handler;
+}
+
+int divider_set_mode(enum DIVIDER_MODE mode) {
+        if (mode != kDividerTimer) {
+                count_edges_t1(0, 0);
+        } else if (!count_edges_t1(timer_edges(countTarget), divider_toggle)) {
+                return 0; // RA4 is a CN pin in this mode, it can't be T1CK
+        }
+        divider_mode = mode;
+        count = 0;
+        update_comparator_interrupt();
+        return 1;
+}
+
+void divider_set_target(int target) {
+        countTarget = target;
+        if (divider_mode == kDividerTimer) {
+                count_edges_t1(timer_edges(target), divider_toggle);
+        }
+}
+
+
+
+// ****************************************************************** thresholds
+// cvref on the non-inverting input, the signal on the inverting one
+static unsigned char read_input_high(void) {
+        return !CMSTATbits.C2OUT;
+}
+
+// moving CVREF can flip the output: wait for it and take the new level as is
+static void arm(unsigned char high) {
+        armed_high = high;
+        cvref_set_code(high ? high_code : low_code);
+        __delay32(kSettleCycles);
+        level = read_input_high();
+        IFS1bits.CMIF = 0;
+        CM2CONbits.CEVT = 0;
+}
+
+static void update_codes(void) {
+        low_code = cvref_code(cmp.low_mv);
+        high_code = cvref_code(cmp.high_mv);
+}
+
+static void shift_thresholds(int16_t mv) {
+        if (mv < 0 && cmp.low_mv < (uint16_t)-mv) {
+                return;
+        }
+        if (mv > 0 && cmp.high_mv + mv > kMaxThresholdMv) {
+                return;
+        }
+        cmp.low_mv += mv;
+        cmp.high_mv += mv;
+        update_codes();
+}
+
+// once per period: the midpoint is where the input is above as long as below
+static void track(void) {
+        uint32_t deadband = (time_high + time_low) / 32;
+        if (time_high > time_low + deadband) {
+                shift_thresholds(kTrackStepMv);
+        } else if (time_low > time_high + deadband) {
+                shift_thresholds(-(int16_t)kTrackStepMv);
         }
+}
 
-        // CVRR has to be 1 in this case, and the output uses a different formula based on CVRR
-        // CVR and CVRR combined determines ref voltage
-        if (vref <= 0.83) {
-                CVRCONbits.CVRR = 1; // supports 0 to 0.83
-                CVRCONbits.CVR = vref * 24.0f / 3.2f; // 3.2 is because 3.2 V is what our 3.5V setting outputs
+static void update_band(void) {
+        if (armed_high) {
+                band = level ? kBandAbove : kBandInside;
         } else {
-                CVRCONbits.CVRR = 0; // supports 0.83 to 2.37
-                CVRCONbits.CVR = (vref - (3.2f / 4.0f)) * 32.0f / 3.2f;
+                band = level ? kBandInside : kBandBelow;
         }
+}
 
-        CVRCONbits.CVRSS = 0; // CVRSS 0 means "use AVdd - AVss" for reference source
+// a comparator event. returns 1 for a real crossing
+static unsigned char threshold_event(uint32_t now) {
+        unsigned char high = read_input_high();
 
-        CVRCONbits.CVREN = 1; // reference enable
-        CVRCONbits.CVROE = 1; // vref output enable (pin 17)
+        cmp_events++;
+        if (CM2CONbits.EVPOL != 0b11) {
+                cmp_crossings++; // one direction only (frequency meter), no level to follow
+                return 1;
+        }
+        if (high == level) {
+                cmp_spurious++; // the output moved and came back before we looked
+                return cmp_mode == kCmpSingle;
+        }
+        if (now - last_crossing < glitch_ticks) {
+                cmp_spurious++; // reversed the last crossing too soon: noise
+        }
 
-        // Disp2Hex(CVRCONbits.CVR);   // debug message
-        // Disp2Hex(CVRCONbits.CVRR);  // debug message
+        if (level) {
+                time_high += now - last_crossing;
+        } else {
+                time_low += now - last_crossing;
+        }
+        level = high;
+        last_crossing = now;
+        crossed_since_poll = 1;
+        cmp_crossings++;
+
+        if (cmp_mode == kCmpHysteresis) {
+                if (high) {
+                        if (cmp.track && time_high) {
+                                track();
+                        }
+                        time_high = 0;
+                        time_low = 0;
+                }
+                arm(!high); // risen past the high edge: now watch the low one
+        } else if (cmp_mode == kCmpWindow) {
+                update_band();
+                if (band == kBandInside) {
+                        arm(!armed_high); // came in over one edge, watch the other
+                }
+        }
+        return 1;
+}
+
+// the poll one shot hands over to the comparator isr so only it touches state
+static void poll(uint32_t now) {
+        if (cmp_mode == kCmpWindow && band == kBandInside) {
+                arm(!armed_high);
+                update_band();
+                if (band != kBandInside) {
+                        cmp_crossings++; // left over the edge we were not watching
+                        last_crossing = now;
+                }
+        } else if (cmp_mode == kCmpHysteresis && !crossed_since_poll) {
+                // all of the signal is on one side, move towards it
+                shift_thresholds(level ? kTrackStepMv : -(int16_t)kTrackStepMv);
+                arm(armed_high);
+        }
+        crossed_since_poll = 0;
+}
+
+static void poll_callback(void) {
+        if (cmp_mode == kCmpWindow) {
+                arm_oneshot_t2(kWindowPollTicks, poll_callback);
+        } else if (cmp_mode == kCmpHysteresis && cmp.track) {
+                arm_oneshot_t2(kTrackPollTicks, poll_callback);
+        } else {
+                return; // reconfigured, stop polling
+        }
+        poll_pending = 1;
+        IFS1bits.CMIF = 1; // a software comparator interrupt
+}
+
+void cmp_configure(const struct cmp_config *config) {
+        IEC1bits.CMIE = 0;
+        cmp = *config;
+        if (cmp.low_mv > cmp.high_mv) {
+                cmp.low_mv = config->high_mv;
+                cmp.high_mv = config->low_mv;
+        }
+        glitch_ticks = (uint32_t)cmp.glitch_us * (TIMESTAMP_TICK_HZ / 1000) / 1000;
+        configured = 1;
+        update_codes();
+        if (cmp.mode == kCmpSingle) {
+                low_code = high_code;
+        }
+
+        start_timestamp_t3();
+        cmp_mode = cmp.mode;
+        last_crossing = get_timestamp_t3();
+        time_high = 0;
+        time_low = 0;
+        poll_pending = 0;
+
+        // where is the input? look from the high edge first
+        arm(1);
+        if (cmp_mode == kCmpHysteresis && level) {
+                arm(0); // already above: wait for the fall past the low edge
+        } else if (cmp_mode == kCmpWindow) {
+                if (!level) {
+                        arm(0);
+                }
+                update_band();
+                if (band == kBandInside) {
+                        arm(1);
+                }
+        }
+
+        update_comparator_interrupt();
+        if (cmp_mode == kCmpWindow || (cmp_mode == kCmpHysteresis && cmp.track)) {
+                poll_callback();
+        }
+}
+
+// the same mv from the new table, CVREF back on the armed edge. the level may
+// have changed while the interrupt was off: hysteresis takes that as a crossing
+void cmp_refresh_thresholds(void) {
+        if (!configured) {
+                return;
+        }
+        IEC1bits.CMIE = 0;
+        update_codes();
+        if (cmp_mode == kCmpSingle) {
+                low_code = high_code;
+        }
+        arm(armed_high);
+        if (cmp_mode == kCmpHysteresis && level == armed_high) {
+                arm(!armed_high);
+        } else if (cmp_mode == kCmpWindow) {
+                update_band();
+        }
+        update_comparator_interrupt();
+}
+
+void cmp_get_stats(struct cmp_stats *stats) {
+        IEC1bits.CMIE = 0;
+        stats->events = cmp_events;
+        stats->crossings = cmp_crossings;
+        stats->spurious = cmp_spurious;
+        stats->low_mv = cvref_code_mv(low_code);
+        stats->high_mv = cvref_code_mv(high_code);
+        stats->band = band;
+        stats->input_high = level;
+        update_comparator_interrupt();
+}
+
+void cmp_clear_stats(void) {
+        IEC1bits.CMIE = 0;
+        cmp_events = 0;
+        cmp_crossings = 0;
+        cmp_spurious = 0;
+        update_comparator_interrupt();
+}
+
+void cmp_set_crossing_handler(cmp_crossing_handler handler) {
+        crossing_handler = handler;
+        update_comparator_interrupt();
+}
+
+
+
+// ******************************************************** threshold conversion
+void cmp_convert(struct cmp_conversion *result) {
+        const uint8_t *codes;
+        uint8_t count = cvref_sorted_codes(&codes);
+        uint8_t lo = 0; // the input is above codes[lo]: the lowest code is 0V
+        uint8_t hi = count; // and below codes[hi], past the end is the top
+        unsigned char enabled = IEC1bits.CMIE;
+        uint8_t threshold = CVREF_CODE(CVRCONbits.CVRR, CVRCONbits.CVR);
+
+        IEC1bits.CMIE = 0; // every code change may flip the output
+        while (hi - lo > 1) {
+                uint8_t mid = (lo + hi) / 2;
+                cvref_set_code(codes[mid]);
+                __delay32(kSettleCycles);
+                if (read_input_high()) {
+                        lo = mid;
+                } else {
+                        hi = mid;
+                }
+        }
+
+        result->code = codes[lo];
+        result->mv = cvref_code_mv(codes[lo]);
+        result->upper_mv = hi < count ? cvref_code_mv(codes[hi]) : 0xffff;
+
+        // put the threshold back for the modes and the divider
+        cvref_set_code(threshold);
+        __delay32(kSettleCycles);
+        level = read_input_high();
+        IFS1bits.CMIF = 0;
+        CM2CONbits.CEVT = 0;
+        IEC1bits.CMIE = enabled;
+}
+
+
+
+// ************************************************************ frequency meter
+// gate one shot: another lap, or close the window and open the next one
+static void gate_callback(void) {
+        uint16_t next_ticks;
+
+        if (!freq_running) {
+                return; // stopped, the slot stays free
+        }
+        IEC1bits.CMIE = 0; // the counters belong to the comparator isr
+        if (freq_count_gate(&meter, get_timestamp_t3(), &next_ticks)) {
+                freq_ready = 1;
+        }
+        update_comparator_interrupt();
+        arm_oneshot_t2(next_ticks, gate_callback);
+}
+
+void freq_start(const struct freq_config *config) {
+        start_timestamp_t3();
+        IEC1bits.CMIE = 0;
+        uint16_t first_ticks = freq_count_start(&meter, config, TIMESTAMP_TICK_HZ,
+                        get_timestamp_t3());
+        if (cmp_mode == kCmpSingle) {
+                CM2CONbits.EVPOL = 0b01; // rising edges only: one event per period
+        }
+        freq_ready = 0;
+        freq_running = 1;
+        IEC1bits.CMIE = 1;
+        arm_oneshot_t2(first_ticks, gate_callback);
+}
+
+void freq_stop(void) {
+        freq_running = 0;
+        cancel_oneshot_t2(gate_callback);
+        CM2CONbits.EVPOL = 0b11; // back to every change, for the divider
+        update_comparator_interrupt();
+}
+
+// 1 and a new result after every gate
+int freq_get(struct freq_result *result) {
+        struct freq_window w;
+
+        if (!freq_ready) {
+                return 0;
+        }
+        unsigned char ipl = SRbits.IPL;
+        SRbits.IPL = 7; // the gate timer writes the window
+        w = meter.window;
+        freq_ready = 0;
+        SRbits.IPL = ipl;
+
+        freq_count_result(&meter, &w, result);
+        return 1;
 }
 
 
@@ -57,6 +423,9 @@ void ComparatorInit(void){
 
     CM2CONbits.CPOL = 0;     //output polarity is set
     CM2CONbits.EVPOL = 0b11; //generate interrupt on any change
+
+    start_timestamp_t3();    //event timestamps, for the spurious count
+    level = read_input_high();
 }
 
 void __attribute__((interrupt, no_auto_psv)) _CompInterrupt(void) {
@@ -64,12 +433,39 @@ void __attribute__((interrupt, no_auto_psv)) _CompInterrupt(void) {
         //    if(CMSTATbits.C1OUT == 1){ // If interrupt due to Comparator 1
         //        //Do nothing
         //    }
-        // increase the count every interrupt
-        count++;
-        // if count equal to the desired division value
-        if (count >= countTarget){
-                LATBbits.LATB9 = !LATBbits.LATB9;   // toggle LED
-                count = 0;                          // resets the counter
+        uint32_t now = get_timestamp_t3();
+        unsigned char crossed = 0;
+
+        if (CM2CONbits.CEVT) {
+                crossed = threshold_event(now);
+        }
+        if (poll_pending) {
+                poll_pending = 0;
+                poll(now);
+        }
+        if (!crossed) {
+                IFS1bits.CMIF = 0;
+                CM2CONbits.CEVT = 0;
+                return; // a poll, or noise the threshold mode filtered out
+        }
+
+        if (crossing_handler) {
+                crossing_handler(level, now);
+        }
+
+        // the threshold modes report both directions, count periods on the rise
+        if (freq_running && (cmp_mode == kCmpSingle || level)) {
+                freq_count_edge(&meter, now);
+        }
+
+        if (divider_mode == kDividerIsr) {
+                // increase the count every interrupt
+                count++;
+                // if count equal to the desired division value
+                if (count >= countTarget){
+                        LATBbits.LATB9 = !LATBbits.LATB9;   // toggle LED
+                        count = 0;                          // resets the counter
+                }
         }
         IFS1bits.CMIF = 0;              // clear IF flag
         CM2CONbits.CEVT = 0; // Interrupts disabled till this bit is cleared
@@ -1,9 +1,117 @@
 #ifndef COMPARATOR_H
 #define COMPARATOR_H
 
+#include <stdint.h>
+
+#include "freq_count.h"
+
+/*
+ * divider: LATB9 toggles every countTarget comparator events
+ *   isr:   _CompInterrupt counts every output change (2 per input period).
+ *          estimated from the instruction count at ~70 cycles per change
+ *          (~35 for the bare divider, the rest is the timestamp, the event
+ *          statistics and the threshold and meter checks added since), so
+ *          at fcy 4MHz the cpu would be saturated by ~30kHz of input and a
+ *          10kHz input would cost ~35%
+ *   timer: the comparator output pin (C2OUT) jumpered to T1CK (pin 10, RA4,
+ *          shared with BTN_CN0, the keypad and the IR receiver), timer 1 counts
+ *          input periods in hardware and interrupts once per toggle.
+ *          countTarget / 2 periods per toggle, odd targets round up. the cpu
+ *          cost is one interrupt (~35 cycles, estimated) per toggle whatever
+ *          the input, which is limited by the comparator and the synchronous
+ *          T1CK input (period > Tcy + 40ns) to a few MHz
+ *   off:   the comparator only feeds the frequency meter
+ * none of these figures is measured: begin_divider_benchmark() in main.c
+ * measures the real cpu load of each mode
+ */
+enum DIVIDER_MODE {
+        kDividerIsr = 0,
+        kDividerTimer,
+        kDividerOff
+};
+
+/*
+ * threshold modes, on top of CVREF (see cvref.h). the input is "high" when it
+ * is above the threshold CVREF currently sits at
+ *   single:     one fixed threshold, every output change is an event
+ *   hysteresis: CVREF jumps to low_mv after a rising crossing and to high_mv
+ *               after a falling one, so noise around either edge no longer
+ *               flips the output. track makes both follow the signal: the
+ *               pair moves until the input spends as long above as below
+ *   window:     in band between low_mv and high_mv or out of it. one
+ *               comparator watches one edge at a time: out of band the near
+ *               edge, in band the two edges alternately every 1ms
+ * an event that comes back within glitch_us of the last crossing, or that did
+ * not change the level at all, counts as spurious
+ */
+enum CMP_MODE {
+        kCmpSingle = 0,
+        kCmpHysteresis,
+        kCmpWindow
+};
+
+enum CMP_BAND {
+        kBandBelow = 0,
+        kBandInside,
+        kBandAbove
+};
+
+struct cmp_config {
+        enum CMP_MODE mode;
+        uint16_t low_mv;        // single uses high_mv only
+        uint16_t high_mv;
+        unsigned char track;    // hysteresis: follow the signal midpoint
+        uint16_t glitch_us;
+};
+
+struct cmp_stats {
+        uint32_t events;        // comparator interrupts
+        uint32_t crossings;     // real ones, what the divider and meter see
+        uint32_t spurious;
+        uint16_t low_mv;        // thresholds as output, tracking moves them
+        uint16_t high_mv;
+        enum CMP_BAND band;     // window mode
+        unsigned char input_high;
+};
+
+/*
+ * threshold conversion: a binary search of the sorted CVREF codes against the
+ * input, 28 distinct levels on the nominal ladder (~5 bits, 33 to 133mV apart
+ * at 3.2V). 5 steps of a code write and a 10us settle, ~55us, with the adc off.
+ * the input is between mv and upper_mv
+ */
+struct cmp_conversion {
+        uint16_t mv;
+        uint16_t upper_mv;      // 0xffff: above the top code
+        uint8_t code;           // of mv
+};
+
+// called from the comparator isr on every real crossing, with the new level
+typedef void (* cmp_crossing_handler)(unsigned char high, uint32_t timestamp);
+
 void CVREFinit(float vref);
 void ComparatorInit(void);
 
+// kDividerIsr after ComparatorInit. 0 if kDividerTimer can't have T1CK (see
+// IR.h), the mode stays as it was
+int divider_set_mode(enum DIVIDER_MODE mode);
+void divider_set_target(int target);
+
+// kCmpSingle after ComparatorInit. CVREF and the comparator must be set up
+void cmp_configure(const struct cmp_config *config);
+void cmp_refresh_thresholds(void); // after cvref_calibrate, nothing until configured
+void cmp_get_stats(struct cmp_stats *stats);
+void cmp_clear_stats(void);
+void cmp_set_crossing_handler(cmp_crossing_handler handler); // 0 removes it
+
+// CM2 on, interrupts from it are held off meanwhile
+void cmp_convert(struct cmp_conversion *result);
+
+// frequency of the comparator input, ComparatorInit first. 0 = default config
+void freq_start(const struct freq_config *config);
+void freq_stop(void);
+int freq_get(struct freq_result *result);
+
 extern volatile int countTarget;
 
 #endif
@@ -0,0 +1,316 @@
+// cvref.c
+
+// libraries & header
+#include "cvref.h"
+#include "libpic30.h"
+#include "xc.h"
+
+// project files
+#include "ADC.h"
+#include "UART2.h"
+
+#define ADC_SAMPLES 16 // per code, the sums stay far below 32 bits
+#define EE_WORDS (CVREF_CODES + 3) // magic, supply, the table, checksum
+
+// Magic Numbers
+static const uint16_t kNominalSupplyMv = 3200; // what the float CVREFinit was tuned to
+static const uint16_t kBandgapMv = 1200; // VBG typical, the absolute reference
+static const uint16_t kAdcFullScale = 1023;
+static const uint16_t kEepromMagic = 0xc7ef;
+static const unsigned char kChannelCvref = 10; // pin 17 == RB14 == AN10, driven with CVROE
+static const unsigned char kChannelBandgap = 0b11101; // internal VBG, see AD1CHS
+static const unsigned long kSettleCycles = 400; // 100us at fcy 4MHz, the ladder needs ~10us
+
+// statics
+static uint16_t __attribute__((space(eedata), aligned(2))) ee_table[EE_WORDS];
+static struct cvref_table table;
+static uint8_t sorted[CVREF_CODES]; // ascending output, for binary searches
+static uint8_t sorted_count = 0;
+static unsigned char calibrated = 0;
+
+
+
+// ************************************************************ core functions
+// the datasheet formulas, in integer mV
+void cvref_ideal_table(struct cvref_table *t, uint16_t supply_mv) {
+        uint8_t code;
+
+        t->supply_mv = supply_mv;
+        for (code = 0; code < CVREF_CODES; code++) {
+                uint32_t cvr = CVREF_CODE_CVR(code);
+                if (CVREF_CODE_CVRR(code)) {
+                        t->mv[code] = (cvr * supply_mv + 12) / 24;
+                } else {
+                        t->mv[code] = ((8 + cvr) * supply_mv + 16) / 32;
+                }
+        }
+}
+
+// the codes overlap and are not sorted, 32 compares is cheap enough
+uint8_t cvref_nearest_code(const struct cvref_table *t, uint16_t mv) {
+        uint8_t best = 0;
+        uint16_t best_error = 0xffff;
+        uint8_t code;
+
+        for (code = 0; code < CVREF_CODES; code++) {
+                uint16_t error = t->mv[code] > mv ? t->mv[code] - mv : mv - t->mv[code];
+                if (error < best_error) {
+                        best_error = error;
+                        best = code;
+                }
+        }
+        return best;
+}
+
+// insertion sort, 32 entries once per calibration. codes within 1mV of one
+// already taken are dropped, the two ranges overlap. returns how many are left
+uint8_t cvref_sort_codes(const struct cvref_table *t, uint8_t *codes) {
+        uint8_t count = 0;
+        uint8_t code;
+        uint8_t j;
+
+        for (code = 0; code < CVREF_CODES; code++) {
+                uint16_t mv = t->mv[code];
+                uint8_t i = count;
+                unsigned char duplicate = 0;
+                while (i > 0 && t->mv[codes[i - 1]] > mv) {
+                        i--;
+                }
+                if (i > 0 && mv - t->mv[codes[i - 1]] <= 1) {
+                        duplicate = 1;
+                }
+                if (i < count && t->mv[codes[i]] - mv <= 1) {
+                        duplicate = 1;
+                }
+                if (duplicate) {
+                        continue;
+                }
+                for (j = count; j > i; j--) {
+                        codes[j] = codes[j - 1];
+                }
+                codes[i] = code;
+                count++;
+        }
+        return count;
+}
+
+// both sums over the same number of samples: avdd cancels out, only VBG is left
+uint16_t cvref_adc_to_mv(uint32_t sum, uint32_t bandgap_sum) {
+        if (bandgap_sum == 0) {
+                return 0;
+        }
+        return (sum * kBandgapMv + bandgap_sum / 2) / bandgap_sum;
+}
+
+
+
+// ************************************************************ helper functions
+static void set_code(uint8_t code) {
+        CVRCONbits.CVRSS = 0; // ladder across avdd - avss
+        CVRCONbits.CVRR = CVREF_CODE_CVRR(code);
+        CVRCONbits.CVR = CVREF_CODE_CVR(code);
+        CVRCONbits.CVREN = 1;
+}
+
+// software started, auto converted after SAMC
+static uint32_t adc_sum(unsigned char channel) {
+        uint32_t sum = 0;
+        unsigned char i;
+
+        AD1CHSbits.CH0SA = channel;
+        for (i = 0; i < ADC_SAMPLES; i++) {
+                AD1CON1bits.SAMP = 1;
+                while (!AD1CON1bits.DONE) {}
+                AD1CON1bits.SAMP = 0;
+                sum += ADC1BUF0;
+        }
+        return sum;
+}
+
+static void init_adc_for_calibration(void) {
+        AD1CON1bits.ADON = 0;
+        AD1CON1bits.FORM = 0b00; // integer
+        AD1CON1bits.SSRC = 0b111; // convert once sampling is done
+        AD1CON1bits.ASAM = 0;
+        AD1CON2bits.VCFG = 0b000; // avdd - avss
+        AD1CON2bits.CSCNA = 0;
+        AD1CON2bits.SMPI = 0;
+        AD1CON2bits.BUFM = 0;
+        AD1CON2bits.ALTS = 0;
+        AD1CON3bits.ADRC = 0;
+        AD1CON3bits.SAMC = 0b11111; // longest sample, VBG is a weak source
+        AD1CHSbits.CH0NA = 0;
+        AD1CON1bits.ADON = 1;
+}
+
+static uint16_t checksum(const uint16_t *words, uint8_t count) {
+        uint16_t sum = 0;
+        while (count--) {
+                sum += *words++;
+        }
+        return sum;
+}
+
+static void eeprom_write(void) {
+        uint16_t words[EE_WORDS];
+        _prog_addressT address;
+        uint8_t i;
+
+        words[0] = kEepromMagic;
+        words[1] = table.supply_mv;
+        for (i = 0; i < CVREF_CODES; i++) {
+                words[2 + i] = table.mv[i];
+        }
+        words[EE_WORDS - 1] = checksum(words, EE_WORDS - 1);
+
+        _init_prog_address(address, ee_table);
+        for (i = 0; i < EE_WORDS; i++, address += 2) {
+                _erase_eedata(address, _EE_WORD);
+                _wait_eedata();
+                _write_eedata_word(address, words[i]);
+                _wait_eedata();
+        }
+}
+
+static int eeprom_read(void) {
+        uint16_t words[EE_WORDS];
+        _prog_addressT address;
+        uint8_t i;
+
+        _init_prog_address(address, ee_table);
+        _memcpy_p2d16(words, address, sizeof(words));
+        if (words[0] != kEepromMagic
+                        || words[EE_WORDS - 1] != checksum(words, EE_WORDS - 1)) {
+                return 0; // erased (all 0xffff) or half written
+        }
+
+        table.supply_mv = words[1];
+        for (i = 0; i < CVREF_CODES; i++) {
+                table.mv[i] = words[2 + i];
+        }
+        return 1;
+}
+
+
+
+// *************************************************************** API functions
+void cvref_init(void) {
+        calibrated = eeprom_read();
+        if (!calibrated) {
+                cvref_ideal_table(&table, kNominalSupplyMv);
+        }
+        sorted_count = cvref_sort_codes(&table, sorted);
+}
+
+uint8_t cvref_code(uint16_t mv) {
+        if (!table.supply_mv) {
+                cvref_init(); // first use
+        }
+        return cvref_nearest_code(&table, mv);
+}
+
+// a handful of instructions, fine from an isr
+void cvref_set_code(uint8_t code) {
+        set_code(code);
+}
+
+uint16_t cvref_code_mv(uint8_t code) {
+        return table.mv[code];
+}
+
+uint8_t cvref_sorted_codes(const uint8_t **codes) {
+        if (!table.supply_mv) {
+                cvref_init();
+        }
+        *codes = sorted;
+        return sorted_count;
+}
+
+uint16_t cvref_set_mv(uint16_t mv) {
+        uint8_t code = cvref_code(mv);
+        set_code(code);
+        return table.mv[code];
+}
+
+// takes over the adc and RB14 (the encoder's B pin) while it runs. a stream
+// or a scan is paused and picks up again after
+// the sweep runs CVREF through every code: the comparator's interrupt is held
+// off meanwhile and its threshold put back in CVRCON after
+static void end_sweep(uint16_t cvrcon, unsigned char cmie) {
+        CVRCON = cvrcon; // CVROE too
+        AD1PCFGbits.PCFG10 = 1;
+        adc_release(kAdcCvref);
+        IFS1bits.CMIF = 0; // crossings of the sweep, not of the input
+        CM2CONbits.CEVT = 0;
+        IEC1bits.CMIE = cmie;
+}
+
+int cvref_calibrate(void) {
+        uint32_t bandgap_sum;
+        uint8_t code;
+
+        if (!adc_claim(kAdcCvref)) {
+                return 0; // the ctmu has it
+        }
+        uint16_t cvrcon = CVRCON;
+        unsigned char cmie = IEC1bits.CMIE;
+        IEC1bits.CMIE = 0;
+        init_adc_for_calibration();
+        TRISBbits.TRISB14 = 1;
+        AD1PCFGbits.PCFG10 = 0; // analog, after the pin is an input
+        CVRCONbits.CVROE = 1;
+
+        bandgap_sum = adc_sum(kChannelBandgap);
+        if (bandgap_sum == 0) {
+                end_sweep(cvrcon, cmie);
+                return 0; // no reading, keep whatever table we had
+        }
+        table.supply_mv = ((uint32_t)kBandgapMv * kAdcFullScale * ADC_SAMPLES
+                        + bandgap_sum / 2) / bandgap_sum;
+
+        for (code = 0; code < CVREF_CODES; code++) {
+                set_code(code);
+                __delay32(kSettleCycles);
+                table.mv[code] = cvref_adc_to_mv(adc_sum(kChannelCvref), bandgap_sum);
+        }
+
+        end_sweep(cvrcon, cmie);
+        sorted_count = cvref_sort_codes(&table, sorted);
+        eeprom_write();
+        calibrated = 1;
+        return 1;
+}
+
+int cvref_is_calibrated(void) {
+        return calibrated;
+}
+
+const struct cvref_table *cvref_get_table(void) {
+        return &table;
+}
+
+int16_t cvref_residual_mv(uint8_t code) {
+        struct cvref_table ideal;
+        cvref_ideal_table(&ideal, table.supply_mv);
+        return (int16_t)(table.mv[code] - ideal.mv[code]);
+}
+
+// per code: cvrr, cvr, measured mV, residual against the ideal ladder
+void cvref_print_report(void) {
+        uint8_t code;
+
+        Disp2String("\n\rcvref supply mV:");
+        Disp2Dec(table.supply_mv);
+        Disp2String(calibrated ? "calibrated" : "nominal");
+        for (code = 0; code < CVREF_CODES; code++) {
+                int16_t residual = cvref_residual_mv(code);
+                Disp2String("\n\rcvrr:");
+                Disp2Dec(CVREF_CODE_CVRR(code));
+                Disp2String("cvr:");
+                Disp2Dec(CVREF_CODE_CVR(code));
+                Disp2String("mV:");
+                Disp2Dec(table.mv[code]);
+                Disp2String(residual < 0 ? "residual mV: -" : "residual mV: +");
+                Disp2Dec(residual < 0 ? -residual : residual);
+        }
+}
@@ -0,0 +1,45 @@
+// cvref.h
+#ifndef CVREF_H
+#define CVREF_H
+
+#include <stdint.h>
+
+/*
+ * the comparator reference in millivolts, integer only. the 32 ladder codes
+ * are indexed cvrr 1 (CVR 0-15, 0 to 0.625 Vsrc) then cvrr 0 (CVR 0-15,
+ * 0.25 to 0.72 Vsrc). until the board is calibrated the table holds the ideal
+ * ladder at kNominalSupplyMv, which is what the old float CVREFinit assumed
+ */
+#define CVREF_CODES 32
+#define CVREF_CODE_CVRR(code) ((code) < 16)
+#define CVREF_CODE_CVR(code) ((code) & 15)
+#define CVREF_CODE(cvrr, cvr) ((cvrr) ? (cvr) : 16 + (cvr))
+
+struct cvref_table {
+        uint16_t supply_mv;             // avdd when measured
+        uint16_t mv[CVREF_CODES];       // ladder output per code
+};
+
+// core functions, no hardware
+void cvref_ideal_table(struct cvref_table *table, uint16_t supply_mv);
+uint8_t cvref_nearest_code(const struct cvref_table *table, uint16_t mv);
+uint8_t cvref_sort_codes(const struct cvref_table *table, uint8_t *codes);
+uint16_t cvref_adc_to_mv(uint32_t sum, uint32_t bandgap_sum);
+
+// the board: loads the stored calibration if there is one
+void cvref_init(void);
+uint16_t cvref_set_mv(uint16_t mv); // returns what the chosen code actually outputs
+uint8_t cvref_code(uint16_t mv); // nearest code, to switch quickly with cvref_set_code
+void cvref_set_code(uint8_t code);
+uint16_t cvref_code_mv(uint8_t code);
+uint8_t cvref_sorted_codes(const uint8_t **codes); // by output, duplicates dropped
+// measures every code with the adc, stores it in eeprom. 0 if the ctmu has the adc.
+// CVRCON is as before, but codes picked from the old table are stale: the
+// comparator's thresholds need cmp_refresh_thresholds()
+int cvref_calibrate(void);
+int cvref_is_calibrated(void);
+const struct cvref_table *cvref_get_table(void);
+int16_t cvref_residual_mv(uint8_t code); // measured - ideal at the measured supply
+void cvref_print_report(void);
+
+#endif
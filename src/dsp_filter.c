@@ -0,0 +1,181 @@
+// dsp_filter.c
+
+// libraries & header
+#include "dsp_filter.h"
+
+
+
+// ************************************************************** moving average
+void dsp_ma_init(struct dsp_ma *f, uint8_t bits) {
+        uint8_t i;
+
+        f->bits = bits > DSP_MA_MAX_BITS ? DSP_MA_MAX_BITS : bits;
+        f->sum = 0;
+        f->index = 0;
+        for (i = 0; i < (1 << DSP_MA_MAX_BITS); i++) {
+                f->history[i] = 0;
+        }
+}
+
+// ramps up from 0 over the first window
+uint16_t dsp_ma_update(struct dsp_ma *f, uint16_t sample) {
+        uint8_t mask = (1 << f->bits) - 1;
+
+        f->sum += sample;
+        f->sum -= f->history[f->index];
+        f->history[f->index] = sample;
+        f->index = (f->index + 1) & mask;
+        return (f->sum + ((mask + 1) >> 1)) >> f->bits;
+}
+
+
+
+// ************************************************************************* iir
+void dsp_iir_init(struct dsp_iir *f, uint8_t shift) {
+        f->shift = shift > 15 ? 15 : shift;
+        f->state = 0;
+        f->primed = 0;
+}
+
+uint16_t dsp_iir_update(struct dsp_iir *f, uint16_t sample) {
+        int32_t x = (int32_t)sample << 16;
+
+        if (!f->primed) {
+                f->state = x;
+                f->primed = 1;
+        }
+        f->state += (x - f->state) >> f->shift; // arithmetic shift, rounds down
+        return (uint16_t)((f->state + 0x8000) >> 16);
+}
+
+
+
+// ********************************************************************** median
+void dsp_median_init(struct dsp_median *f, uint8_t length) {
+        if (length == 0) {
+                length = 1;
+        }
+        if (length > DSP_MEDIAN_MAX) {
+                length = DSP_MEDIAN_MAX;
+        }
+        f->length = length | 1; // odd, so there is a middle
+        f->count = 0;
+        f->index = 0;
+}
+
+// the oldest sample leaves the sorted copy, the new one goes in where it fits
+uint16_t dsp_median_update(struct dsp_median *f, uint16_t sample) {
+        uint8_t i;
+
+        if (f->count == f->length) {
+                uint16_t oldest = f->history[f->index];
+                for (i = 0; f->sorted[i] != oldest; i++) {}
+                for (; i + 1 < f->count; i++) {
+                        f->sorted[i] = f->sorted[i + 1];
+                }
+                f->count--;
+        }
+        f->history[f->index] = sample;
+        f->index = f->index + 1 == f->length ? 0 : f->index + 1;
+
+        for (i = f->count; i > 0 && f->sorted[i - 1] > sample; i--) {
+                f->sorted[i] = f->sorted[i - 1];
+        }
+        f->sorted[i] = sample;
+        f->count++;
+        return f->sorted[f->count >> 1];
+}
+
+
+
+// ************************************************************************* cic
+void dsp_cic_init(struct dsp_cic *f, uint8_t order, uint8_t rate_bits) {
+        uint8_t i;
+
+        if (order == 0) {
+                order = 1;
+        }
+        f->order = order > DSP_CIC_MAX_ORDER ? DSP_CIC_MAX_ORDER : order;
+        f->rate_bits = rate_bits > 6 ? 6 : rate_bits;
+        f->phase = 0;
+        for (i = 0; i < DSP_CIC_MAX_ORDER; i++) {
+                f->integrator[i] = 0;
+                f->delay[i] = 0;
+        }
+}
+
+// integrators every sample, combs every 2^rate_bits. the gain is
+// 2^(order * rate_bits), shifted back out so the output scale is the input's
+int dsp_cic_update(struct dsp_cic *f, uint16_t sample, uint16_t *out) {
+        uint32_t x = sample;
+        uint8_t i;
+
+        for (i = 0; i < f->order; i++) {
+                f->integrator[i] += x;
+                x = f->integrator[i];
+        }
+        if (++f->phase < (1 << f->rate_bits)) {
+                return 0;
+        }
+        f->phase = 0;
+
+        for (i = 0; i < f->order; i++) {
+                uint32_t y = x - f->delay[i];
+                f->delay[i] = x;
+                x = y;
+        }
+        *out = (uint16_t)(x >> (f->order * f->rate_bits));
+        return 1;
+}
+
+
+
+// ********************************************************************* generic
+void dsp_filter_init(struct dsp_filter *f, enum DSP_KIND kind, uint8_t param) {
+        f->kind = kind;
+        switch (kind) {
+        case kDspMovingAverage:
+                dsp_ma_init(&f->u.ma, param);
+                break;
+        case kDspIir:
+                dsp_iir_init(&f->u.iir, param);
+                break;
+        case kDspMedian:
+                dsp_median_init(&f->u.median, param);
+                break;
+        case kDspCic:
+                dsp_cic_init(&f->u.cic, param >> 4, param & 0x0f);
+                break;
+        }
+}
+
+int dsp_filter_update(struct dsp_filter *f, uint16_t sample, uint16_t *out) {
+        switch (f->kind) {
+        case kDspMovingAverage:
+                *out = dsp_ma_update(&f->u.ma, sample);
+                return 1;
+        case kDspIir:
+                *out = dsp_iir_update(&f->u.iir, sample);
+                return 1;
+        case kDspMedian:
+                *out = dsp_median_update(&f->u.median, sample);
+                return 1;
+        case kDspCic:
+                return dsp_cic_update(&f->u.cic, sample, out);
+        }
+        return 0;
+}
+
+// outputs never get ahead of inputs, so out may be in
+uint8_t dsp_filter_block(struct dsp_filter *f, const uint16_t *in, uint8_t count,
+                uint16_t *out) {
+        uint8_t produced = 0;
+        uint8_t i;
+
+        for (i = 0; i < count; i++) {
+                if (dsp_filter_update(f, in[i], &out[produced])) {
+                        produced++;
+                }
+        }
+        return produced;
+}
@@ -0,0 +1,83 @@
+// dsp_filter.h
+#ifndef DSP_FILTER_H
+#define DSP_FILTER_H
+
+#include <stdint.h>
+
+/*
+ * integer filters for adc samples (10 bit, or up to 14 oversampled). no float,
+ * no divides, no hardware: each keeps its own state so any number can run side
+ * by side, fed from an isr, the main loop or a host test
+ */
+#define DSP_MA_MAX_BITS 5 // moving average windows up to 32
+#define DSP_MEDIAN_MAX 7 // odd
+#define DSP_CIC_MAX_ORDER 3 // with decimation up to 64, 14 + 3 * 6 bits fit in 32
+
+// moving average over 2^bits samples, running sum: one add, one subtract
+struct dsp_ma {
+        uint16_t history[1 << DSP_MA_MAX_BITS];
+        uint32_t sum;
+        uint8_t bits;
+        uint8_t index;
+};
+
+// single pole iir, y += (x - y) / 2^shift. the state keeps 16 fraction bits
+struct dsp_iir {
+        int32_t state;
+        uint8_t shift;
+        uint8_t primed;         // starts at the first sample instead of 0
+};
+
+// median of the last length samples, kept sorted: length compares per sample
+struct dsp_median {
+        uint16_t history[DSP_MEDIAN_MAX];
+        uint16_t sorted[DSP_MEDIAN_MAX];
+        uint8_t length;
+        uint8_t count;          // less than length until the window has filled
+        uint8_t index;
+};
+
+// cascaded integrator comb, decimating by 2^rate_bits. the registers wrap
+// modulo 2^32, the combs take the wraps back out
+struct dsp_cic {
+        uint32_t integrator[DSP_CIC_MAX_ORDER];
+        uint32_t delay[DSP_CIC_MAX_ORDER];
+        uint8_t order;
+        uint8_t rate_bits;
+        uint8_t phase;
+};
+
+enum DSP_KIND {
+        kDspMovingAverage,
+        kDspIir,
+        kDspMedian,
+        kDspCic
+};
+
+// any of the above behind one call, to plug into a sample stream
+struct dsp_filter {
+        enum DSP_KIND kind;
+        union {
+                struct dsp_ma ma;
+                struct dsp_iir iir;
+                struct dsp_median median;
+                struct dsp_cic cic;
+        } u;
+};
+
+void dsp_ma_init(struct dsp_ma *f, uint8_t bits);
+uint16_t dsp_ma_update(struct dsp_ma *f, uint16_t sample);
+void dsp_iir_init(struct dsp_iir *f, uint8_t shift); // time constant ~2^shift samples
+uint16_t dsp_iir_update(struct dsp_iir *f, uint16_t sample);
+void dsp_median_init(struct dsp_median *f, uint8_t length);
+uint16_t dsp_median_update(struct dsp_median *f, uint16_t sample);
+void dsp_cic_init(struct dsp_cic *f, uint8_t order, uint8_t rate_bits);
+int dsp_cic_update(struct dsp_cic *f, uint16_t sample, uint16_t *out); // 1 per 2^rate_bits
+
+// param: window bits, shift, length or (order << 4) | rate_bits by kind
+void dsp_filter_init(struct dsp_filter *f, enum DSP_KIND kind, uint8_t param);
+int dsp_filter_update(struct dsp_filter *f, uint16_t sample, uint16_t *out); // 0 if decimated away
+uint8_t dsp_filter_block(struct dsp_filter *f, const uint16_t *in, uint8_t count,
+                uint16_t *out); // returns how many came out, in place is fine
+
+#endif
@@ -0,0 +1,72 @@
+// encoder.c
+
+// libraries & header
+#include "encoder.h"
+#include "xc.h"
+
+// project files
+#include "CN.h"
+#include "Timer.h"
+
+// board wiring, both on port B
+static const uint16_t kPinA = 1 << 12; // pin 15 == RB12 == CN14
+static const uint16_t kPinB = 1 << 14; // pin 17 == RB14 == CN12
+
+// Magic Numbers
+static const uint16_t kFastTicks = TIMESTAMP_TICK_HZ / 1000 * 15;   // detents < 15ms apart: 4x
+static const uint16_t kMediumTicks = TIMESTAMP_TICK_HZ / 1000 * 40; // detents < 40ms apart: 2x
+
+// statics
+static struct quad_decoder encoder;
+static int32_t position_taken = 0; // main loop only
+
+
+
+// ****************************************************************** CN handler
+// A and B share it, the snapshot gives both levels of the same instant. the
+// 32 bit timestamp keeps a slow turn from wrapping into a fast one
+static void encoder_cn_handler(unsigned char level, uint16_t timestamp) {
+        uint16_t port = cn_snapshot(kCnPortB);
+        unsigned char ab = ((port & kPinA) ? 2 : 0) | ((port & kPinB) ? 1 : 0);
+        quad_update(&encoder, ab, get_timestamp_t3());
+}
+
+
+
+// *************************************************************** API functions
+void encoder_init(void) {
+        AD1PCFG |= (1 << 12) | (1 << 10); // RB12 / RB14 are AN12 / AN10, make them digital
+        cn_register(14, kCnPortB, kPinA, kCnPullUp, encoder_cn_handler);
+        cn_register(12, kCnPortB, kPinB, kCnPullUp, encoder_cn_handler);
+
+        IEC1bits.CNIE = 0;
+        uint16_t port = PORTB;
+        quad_init(&encoder, ((port & kPinA) ? 2 : 0) | ((port & kPinB) ? 1 : 0),
+                        kFastTicks, kMediumTicks);
+        IEC1bits.CNIE = 1;
+}
+
+// the CN isr updates it, a 32 bit read is two instructions on this chip
+int32_t encoder_position(void) {
+        unsigned char ipl = SRbits.IPL;
+        SRbits.IPL = 7;
+        int32_t position = encoder.position;
+        SRbits.IPL = ipl;
+        return position;
+}
+
+int16_t encoder_take_delta(void) {
+        int32_t position = encoder_position();
+        int32_t delta = position - position_taken;
+        if (delta > 0x7fff) {
+                delta = 0x7fff;
+        } else if (delta < -0x7fff) {
+                delta = -0x7fff;
+        }
+        position_taken += delta;
+        return delta;
+}
+
+uint16_t encoder_errors(void) {
+        return encoder.errors;
+}
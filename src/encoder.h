@@ -0,0 +1,15 @@
+// encoder.h
+#ifndef ENCODER_H
+#define ENCODER_H
+
+#include <stdint.h>
+
+#include "quad_decode.h"
+
+// the encoder on the board
+void encoder_init(void); // call CN_init first
+int32_t encoder_position(void);
+int16_t encoder_take_delta(void); // detents since the last call
+uint16_t encoder_errors(void);
+
+#endif
@@ -0,0 +1,92 @@
+// freq_count.c
+
+// libraries & header
+#include "freq_count.h"
+
+#define STRETCH_S 10 // reciprocal waits this long for 2 edges
+
+static const uint32_t kPow10[4] = {1, 10, 100, 1000};
+static const struct freq_config kDefaultFreqConfig = {1000, kFreqAuto, 1};
+
+
+
+// ************************************************************ helper functions
+static void open_gate(struct freq_counter *f, uint32_t now) {
+        f->edges = 0;
+        f->open = now;
+        f->ticks_left = (uint32_t)f->config.gate_ms * (f->tick_hz / 1000);
+}
+
+static uint16_t next_lap(const struct freq_counter *f) {
+        return f->ticks_left > FREQ_MAX_LAP_TICKS ? FREQ_MAX_LAP_TICKS : f->ticks_left;
+}
+
+
+
+// ************************************************************ core functions
+uint16_t freq_count_start(struct freq_counter *f, const struct freq_config *config,
+                uint32_t tick_hz, uint32_t now) {
+        f->config = config ? *config : kDefaultFreqConfig;
+        if (f->config.decimals > 3) {
+                f->config.decimals = 3;
+        }
+        if (!f->config.gate_ms) {
+                f->config.gate_ms = 1;
+        }
+        f->tick_hz = tick_hz;
+        open_gate(f, now);
+        return next_lap(f);
+}
+
+// another lap, or close the window and open the next one
+int freq_count_gate(struct freq_counter *f, uint32_t now, uint16_t *next_ticks) {
+        if (f->ticks_left > FREQ_MAX_LAP_TICKS) {
+                f->ticks_left -= FREQ_MAX_LAP_TICKS;
+                *next_ticks = next_lap(f);
+                return 0;
+        }
+
+        // reciprocal needs two edges: below 1 / gate, stretch the gate until
+        // they arrive instead of reporting a 0 or 1 count
+        if (f->config.mode != kFreqGated && f->edges < 2
+                        && now - f->open < STRETCH_S * f->tick_hz) {
+                *next_ticks = FREQ_MAX_LAP_TICKS;
+                return 0;
+        }
+
+        f->window.edges = f->edges;
+        f->window.first = f->first;
+        f->window.last = f->last;
+        f->window.gate_ticks = now - f->open;
+        open_gate(f, now);
+        *next_ticks = next_lap(f);
+        return 1;
+}
+
+// Hz * 10^decimals, rounded. gated: edges / gate. reciprocal: whole periods
+// between the first and the last edge / their exact distance
+void freq_count_result(const struct freq_counter *f, const struct freq_window *w,
+                struct freq_result *result) {
+        uint64_t scale = (uint64_t)f->tick_hz * kPow10[f->config.decimals];
+        enum FREQ_MODE mode = f->config.mode;
+        uint32_t periods;
+        uint32_t ticks;
+
+        if (mode == kFreqAuto) {
+                // the edge timestamps resolve 1 tick, far finer than 1 count per gate
+                mode = w->edges >= 2 ? kFreqReciprocal : kFreqGated;
+        }
+
+        if (mode == kFreqReciprocal && w->edges >= 2) {
+                periods = w->edges - 1;
+                ticks = w->last - w->first;
+        } else {
+                periods = w->edges;
+                ticks = w->gate_ticks;
+        }
+
+        result->mode = mode;
+        result->periods = periods;
+        result->ticks = ticks;
+        result->value = ticks ? (periods * scale + ticks / 2) / ticks : 0;
+}
@@ -0,0 +1,67 @@
+#ifndef FREQ_COUNT_H
+#define FREQ_COUNT_H
+
+#include <stdint.h>
+
+enum FREQ_MODE {
+        kFreqGated = 0,         // edges in the gate, resolution 1 / gate time
+        kFreqReciprocal,        // periods over their measured time, the gate stretches to 2 edges
+        kFreqAuto               // reciprocal whenever 2 edges fell in the gate
+};
+
+struct freq_config {
+        uint16_t gate_ms;       // a result every gate
+        enum FREQ_MODE mode;
+        unsigned char decimals; // result in Hz * 10^decimals, 0 to 3
+};
+
+struct freq_result {
+        uint32_t value;         // Hz * 10^decimals
+        enum FREQ_MODE mode;    // gated or reciprocal, as used
+        uint32_t periods;
+        uint32_t ticks;         // TIMESTAMP_TICK_HZ ticks the periods took
+};
+
+#define FREQ_MAX_LAP_TICKS 60000 // per lap of the gate one shot (120ms at 500kHz)
+
+/*
+ * the counting behind the frequency meter, kept apart from the comparator and
+ * the timers so it can be fed from anywhere (and tested on a host, see
+ * tools/freq_sim.c). the edge source calls freq_count_edge() on every rising
+ * edge, the gate one shot calls freq_count_gate() and re-arms itself for the
+ * ticks it hands back. times are 32 bit timestamps of tick_hz
+ */
+struct freq_window {
+        uint32_t edges;
+        uint32_t first;
+        uint32_t last;
+        uint32_t gate_ticks;
+};
+
+struct freq_counter {
+        struct freq_config config;
+        uint32_t tick_hz;
+        uint32_t edges;                 // the open gate
+        uint32_t first;
+        uint32_t last;
+        uint32_t open;                  // when it opened
+        uint32_t ticks_left;            // of its laps
+        struct freq_window window;      // the last gate closed
+};
+
+// opens the first gate. returns the ticks to its first freq_count_gate() call
+uint16_t freq_count_start(struct freq_counter *f, const struct freq_config *config,
+                uint32_t tick_hz, uint32_t now);
+// 1 if this call closed the gate into f->window and opened the next one
+int freq_count_gate(struct freq_counter *f, uint32_t now, uint16_t *next_ticks);
+void freq_count_result(const struct freq_counter *f, const struct freq_window *w,
+                struct freq_result *result);
+
+static inline void freq_count_edge(struct freq_counter *f, uint32_t now) {
+        if (f->edges++ == 0) {
+                f->first = now;
+        }
+        f->last = now;
+}
+
+#endif
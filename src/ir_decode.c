@@ -0,0 +1,523 @@
+
+// libraries & header
+#include "ir_decode.h"
+
+// windows come precomputed in timer ticks, see IR_TIMING_TABLE
+#define IN_WINDOW(val, sym) in_window((val), &timing->w[sym])
+#define IN_RANGE(val, sym) (((val) > timing->w[sym].min) && ((val) < timing->w[sym].max))
+
+static const uint8_t kPulseDistanceBits = 32;
+static const uint8_t kRc5Halves = 28;     // 14 manchester bits
+static const uint8_t kRc6Units = 44;      // start + 3 mode + double trailer + 16 data
+static const unsigned char kNoToggle = 0xff;
+static const uint16_t kScaleOne = 256;         // q8
+static const unsigned char kGoodToLock = 4;    // frames before the windows narrow
+static const unsigned char kMissesToReset = 3; // failures before going back to nominal
+
+// which protocols use each symbol, for re-centring after a frame
+#define P(protocol) (1 << (protocol))
+static const uint8_t kSymbolProtocols[kIrSymbolCount] = {
+        P(kIrSamsung),                  // kSymSamsungHdr
+        P(kIrNec),                      // kSymNecHdrMark
+        P(kIrNec),                      // kSymNecHdrSpace
+        P(kIrNec),                      // kSymNecRepeatSpace
+        P(kIrSamsung) | P(kIrNec),      // kSymBitMark
+        P(kIrSamsung) | P(kIrNec),      // kSymZeroSpace
+        P(kIrSamsung) | P(kIrNec),      // kSymOneSpace
+        P(kIrSony),                     // kSymSonyHdr
+        P(kIrSony),                     // kSymSonyUnit
+        P(kIrSony),                     // kSymSonyOne
+        P(kIrRc5),                      // kSymRc5Half
+        P(kIrRc5),                      // kSymRc5Full
+        P(kIrRc6),                      // kSymRc6HdrMark
+        P(kIrRc6),                      // kSymRc6HdrSpace
+        P(kIrRc6),                      // kSymRc6Unit1
+        P(kIrRc6),                      // kSymRc6Unit2
+        P(kIrRc6),                      // kSymRc6Unit3
+};
+#undef P
+
+// timing quality of the frame being decoded
+static uint16_t worst_dev;
+static uint16_t worst_half;
+static uint16_t worst_centre;
+static uint32_t measured_sum;
+static uint32_t nominal_sum;
+
+// statics (repeat detection for protocols that signal it)
+static struct ir_frame last_nec;
+static unsigned char nec_valid = 0;
+static unsigned char rc5_last_toggle = 0xff;
+static unsigned char rc6_last_toggle = 0xff;
+
+
+
+// ************************************************************ helper functions
+// window test that also records how far off centre every accepted pulse was
+static int in_window(uint16_t val, const struct ir_window *window) {
+        if (val <= window->min || val >= window->max) {
+                return 0;
+        }
+
+        uint16_t centre = ((uint32_t)window->min + window->max) >> 1;
+        uint16_t half = (window->max - window->min) >> 1;
+        uint16_t dev = val > centre ? val - centre : centre - val;
+
+        // dev / half > worst_dev / worst_half, without dividing per pulse
+        if ((uint32_t)dev * worst_half >= (uint32_t)worst_dev * half) {
+                worst_dev = dev;
+                worst_half = half;
+                worst_centre = centre;
+        }
+        measured_sum += val;
+        nominal_sum += centre;
+        return 1;
+}
+
+// returns how many units the duration spans (1 .. max_units), 0 if none
+static uint8_t count_units(uint16_t duration, const struct ir_window *unit_windows,
+                uint8_t max_units) {
+        uint8_t n;
+        for (n = 0; n < max_units; n++) {
+                if (in_window(duration, &unit_windows[n])) {
+                        return n + 1;
+                }
+        }
+        return 0;
+}
+
+// expands alternating mark/space pulses into one level per time unit
+static uint8_t expand_units(const uint16_t *pulses, uint8_t count, unsigned char first_level,
+                const struct ir_window *unit_windows, uint8_t max_units,
+                unsigned char *levels, uint8_t max_levels) {
+        uint8_t i;
+        uint8_t n = 0;
+        unsigned char level = first_level;
+
+        for (i = 0; i < count && n < max_levels; i++) {
+                uint8_t units = count_units(pulses[i], unit_windows, max_units);
+                if (units == 0) {
+                        break; // gap after the frame, or garbage
+                }
+                while (units-- && n < max_levels) {
+                        levels[n++] = level;
+                }
+                level = !level;
+        }
+        return n;
+}
+
+static enum IR_PROTOCOL identify_protocol(const uint16_t *pulses, uint8_t count,
+                const struct ir_timing *timing) {
+        uint16_t mark = pulses[0];
+        uint16_t space = count > 1 ? pulses[1] : 0;
+
+        // plain range checks: only the chosen decoder's checks count for quality
+
+        if (IN_RANGE(mark, kSymNecHdrMark)) {
+                return kIrNec;
+        }
+        if (IN_RANGE(mark, kSymSamsungHdr)) {
+                return kIrSamsung;
+        }
+        if (IN_RANGE(mark, kSymRc6HdrMark) && IN_RANGE(space, kSymRc6HdrSpace)) {
+                return kIrRc6;
+        }
+        if (IN_RANGE(mark, kSymSonyHdr) && IN_RANGE(space, kSymSonyUnit)) {
+                return kIrSony;
+        }
+        if (IN_RANGE(mark, kSymRc5Half) || IN_RANGE(mark, kSymRc5Full)) {
+                return kIrRc5;
+        }
+        return kIrUnknown;
+}
+
+
+
+// ************************************************************ protocol decoders
+// header at pulses[0..1], then 32 x (mark, space); bit value is in the space
+static int decode_pulse_distance(const uint16_t *pulses, uint8_t count,
+                const struct ir_timing *timing, unsigned char lsb_first, uint32_t *bits) {
+        uint8_t i;
+        uint32_t output = 0;
+
+        if (count < 2 + 2 * kPulseDistanceBits) {
+                return 0;
+        }
+
+        for (i = 0; i < kPulseDistanceBits; i++) {
+                uint16_t mark = pulses[2 + 2 * i];
+                uint16_t space = pulses[3 + 2 * i];
+                uint32_t bit;
+
+                if (!IN_WINDOW(mark, kSymBitMark)) {
+                        return 0;
+                }
+                if (IN_WINDOW(space, kSymZeroSpace)) {
+                        bit = 0;
+                } else if (IN_WINDOW(space, kSymOneSpace)) {
+                        bit = 1;
+                } else {
+                        return 0;
+                }
+
+                if (lsb_first) {
+                        output |= bit << i;
+                } else {
+                        output = (output << 1) | bit;
+                }
+        }
+
+        *bits = output;
+        return 1;
+}
+
+static int decode_samsung(const uint16_t *pulses, uint8_t count,
+                const struct ir_timing *timing, struct ir_frame *frame) {
+        uint32_t bits;
+
+        if (count < 2 || !IN_WINDOW(pulses[0], kSymSamsungHdr)
+                        || !IN_WINDOW(pulses[1], kSymSamsungHdr)) {
+                return 0;
+        }
+        if (!decode_pulse_distance(pulses, count, timing, 0, &bits)) {
+                return 0;
+        }
+
+        // custom code (16 bit), data byte, inverted data byte
+        uint8_t command = (bits >> 8) & 0xff;
+        if ((uint8_t)~command != (uint8_t)(bits & 0xff)) {
+                return 0;
+        }
+
+        frame->address = bits >> 16;
+        frame->command = command;
+        frame->raw = bits;
+        frame->repeat = 0; // samsung resends the full frame while held
+        return 1;
+}
+
+static int decode_nec(const uint16_t *pulses, uint8_t count,
+                const struct ir_timing *timing, struct ir_frame *frame) {
+        uint32_t bits;
+
+        if (count < 3 || !IN_WINDOW(pulses[0], kSymNecHdrMark)) {
+                return 0;
+        }
+
+        // repeat code: 9ms mark, 2.25ms space, 560us mark
+        if (IN_WINDOW(pulses[1], kSymNecRepeatSpace) && IN_WINDOW(pulses[2], kSymBitMark)) {
+                if (!nec_valid) {
+                        return 0;
+                }
+                *frame = last_nec;
+                frame->repeat = 1;
+                return 1;
+        }
+
+        if (!IN_WINDOW(pulses[1], kSymNecHdrSpace)) {
+                return 0;
+        }
+        if (!decode_pulse_distance(pulses, count, timing, 1, &bits)) {
+                return 0;
+        }
+
+        // address, inverted address (or extended address), command, inverted command
+        uint8_t addr_lo = bits & 0xff;
+        uint8_t addr_hi = (bits >> 8) & 0xff;
+        uint8_t command = (bits >> 16) & 0xff;
+        uint8_t inverted = ~command; // in a uint8_t, not compared as the promoted int
+        if (inverted != (uint8_t)(bits >> 24)) {
+                return 0;
+        }
+
+        inverted = ~addr_lo;
+        if (inverted == addr_hi) {
+                frame->address = addr_lo;
+        } else {
+                frame->address = ((uint16_t)addr_hi << 8) | addr_lo;
+        }
+        frame->command = command;
+        frame->raw = bits;
+        frame->repeat = 0;
+
+        last_nec = *frame;
+        nec_valid = 1;
+        return 1;
+}
+
+// pulse width: 2.4ms header, then (600us space, 600/1200us mark) per bit, lsb first
+static int decode_sony(const uint16_t *pulses, uint8_t count,
+                const struct ir_timing *timing, struct ir_frame *frame) {
+        uint8_t n_bits = 0;
+        uint32_t bits = 0;
+        uint8_t i;
+
+        if (!IN_WINDOW(pulses[0], kSymSonyHdr)) {
+                return 0;
+        }
+
+        for (i = 1; i + 1 < count && n_bits < 20; i += 2) {
+                if (!IN_WINDOW(pulses[i], kSymSonyUnit)) {
+                        break; // gap before the next frame
+                }
+                if (IN_WINDOW(pulses[i + 1], kSymSonyOne)) {
+                        bits |= (uint32_t)1 << n_bits;
+                } else if (!IN_WINDOW(pulses[i + 1], kSymSonyUnit)) {
+                        return 0;
+                }
+                n_bits++;
+        }
+
+        if (n_bits != 12 && n_bits != 15 && n_bits != 20) {
+                return 0;
+        }
+
+        // 7 command bits, then 5, 8 or 13 (5 + 8 extended) address bits
+        frame->command = bits & 0x7f;
+        frame->address = bits >> 7;
+        frame->raw = bits;
+        frame->repeat = 0;
+        return 1;
+}
+
+// manchester, 889us halves, 1 = space then mark. first space is hidden in the idle
+static int decode_rc5(const uint16_t *pulses, uint8_t count,
+                const struct ir_timing *timing, struct ir_frame *frame) {
+        unsigned char levels[28];
+        uint8_t n;
+        uint8_t i;
+        uint16_t word = 0;
+
+        levels[0] = 0;
+        n = 1 + expand_units(pulses, count, 1, &timing->w[kSymRc5Half], 2, &levels[1], kRc5Halves - 1);
+        if (n == kRc5Halves - 1 && levels[n - 1] == 1) {
+                levels[n++] = 0; // trailing space of a final '0' merges into the gap
+        }
+        if (n != kRc5Halves) {
+                return 0;
+        }
+
+        for (i = 0; i < kRc5Halves; i += 2) {
+                if (levels[i] == levels[i + 1]) {
+                        return 0;
+                }
+                word = (word << 1) | levels[i + 1];
+        }
+
+        // S1, S2 (inverted command bit 6), toggle, 5 address bits, 6 command bits
+        unsigned char toggle = (word >> 11) & 0x1;
+        frame->address = (word >> 6) & 0x1f;
+        frame->command = (word & 0x3f) | (((word >> 12) & 0x1) ? 0 : 0x40);
+        frame->raw = word;
+        frame->repeat = (rc5_last_toggle != kNoToggle) && (toggle == rc5_last_toggle);
+        rc5_last_toggle = toggle;
+        return 1;
+}
+
+// rc6 mode 0: leader, then manchester with 444us units, 1 = mark then space
+static int decode_rc6(const uint16_t *pulses, uint8_t count,
+                const struct ir_timing *timing, struct ir_frame *frame) {
+        unsigned char levels[44];
+        uint8_t n;
+        uint8_t i;
+        uint8_t mode = 0;
+        uint16_t data = 0;
+
+        if (count < 3 || !IN_WINDOW(pulses[0], kSymRc6HdrMark)
+                        || !IN_WINDOW(pulses[1], kSymRc6HdrSpace)) {
+                return 0;
+        }
+
+        n = expand_units(&pulses[2], count - 2, 1, &timing->w[kSymRc6Unit1], 3, levels, kRc6Units);
+        if (n == kRc6Units - 1 && levels[n - 1] == 1) {
+                levels[n++] = 0; // trailing space of a final '1' merges into the gap
+        }
+        if (n != kRc6Units) {
+                return 0;
+        }
+
+        // start bit is always 1
+        if (levels[0] != 1 || levels[1] != 0) {
+                return 0;
+        }
+
+        for (i = 0; i < 3; i++) {
+                if (levels[2 + 2 * i] == levels[3 + 2 * i]) {
+                        return 0;
+                }
+                mode = (mode << 1) | levels[2 + 2 * i];
+        }
+        if (mode != 0) {
+                return 0; // only mode 0 (consumer electronics) is handled
+        }
+
+        // trailer (toggle) bit is double width
+        if (levels[8] != levels[9] || levels[10] != levels[11] || levels[8] == levels[10]) {
+                return 0;
+        }
+        unsigned char toggle = levels[8];
+
+        for (i = 0; i < 16; i++) {
+                if (levels[12 + 2 * i] == levels[13 + 2 * i]) {
+                        return 0;
+                }
+                data = (data << 1) | levels[12 + 2 * i];
+        }
+
+        frame->address = data >> 8;
+        frame->command = data & 0xff;
+        frame->raw = data;
+        frame->repeat = (rc6_last_toggle != kNoToggle) && (toggle == rc6_last_toggle);
+        rc6_last_toggle = toggle;
+        return 1;
+}
+
+
+
+// *************************************************************** API functions
+int ir_decode(const uint16_t *pulses, uint8_t count, const struct ir_timing *timing,
+                struct ir_frame *frame) {
+        int decoded = 0;
+
+        frame->protocol = kIrUnknown;
+        frame->deviation_pct = 0;
+        frame->confidence = 0;
+        frame->speed_q8 = kScaleOne;
+        worst_dev = 0;
+        worst_half = 1;
+        worst_centre = 1;
+        measured_sum = 0;
+        nominal_sum = 0;
+        if (count == 0) {
+                return 0;
+        }
+
+        enum IR_PROTOCOL protocol = identify_protocol(pulses, count, timing);
+        switch (protocol) {
+        case kIrSamsung:
+                decoded = decode_samsung(pulses, count, timing, frame);
+                break;
+        case kIrNec:
+                decoded = decode_nec(pulses, count, timing, frame);
+                break;
+        case kIrRc5:
+                decoded = decode_rc5(pulses, count, timing, frame);
+                break;
+        case kIrRc6:
+                decoded = decode_rc6(pulses, count, timing, frame);
+                break;
+        case kIrSony:
+                decoded = decode_sony(pulses, count, timing, frame);
+                break;
+        default:
+                break;
+        }
+
+        frame->protocol = protocol;
+        if (decoded && nominal_sum > 0) {
+                uint16_t off_edge = (uint32_t)worst_dev * 100 / worst_half;
+                frame->deviation_pct = (uint32_t)worst_dev * 100 / worst_centre;
+                frame->confidence = off_edge >= 100 ? 0 : 100 - off_edge;
+                frame->speed_q8 = (measured_sum << 8) / nominal_sum;
+        }
+        return decoded;
+}
+
+// the pulse the glitch cut short continues: its length goes back into the
+// time since the last edge
+enum IR_EDGE ir_filter_edge(uint16_t *pulses, uint8_t *count, uint8_t max,
+                uint16_t *last_edge, uint16_t now, uint16_t min_ticks) {
+        // unsigned difference handles the timer wrapping around
+        uint16_t pulse = now - *last_edge;
+
+        if (pulse < min_ticks) {
+                if (*count == 0) {
+                        return kIrEdgeGlitchFirst;
+                }
+                (*count)--;
+                *last_edge -= pulses[*count];
+                return kIrEdgeGlitch;
+        }
+        *last_edge = now;
+        if (*count >= max) {
+                return kIrEdgeOverrun;
+        }
+        pulses[(*count)++] = pulse;
+        return kIrEdgeStored;
+}
+
+const char *ir_protocol_name(enum IR_PROTOCOL protocol) {
+        switch (protocol) {
+        case kIrSamsung:
+                return "Samsung";
+        case kIrNec:
+                return "NEC";
+        case kIrRc5:
+                return "RC5";
+        case kIrRc6:
+                return "RC6";
+        case kIrSony:
+                return "Sony";
+        default:
+                return "Unknown";
+        }
+}
+
+void ir_tracker_init(struct ir_tracker *tracker, const struct ir_timing *nominal) {
+        uint8_t i;
+
+        tracker->timing = *nominal;
+        for (i = 0; i < kIrProtocolCount; i++) {
+                tracker->scale_q8[i] = kScaleOne;
+                tracker->good[i] = 0;
+                tracker->misses[i] = 0;
+        }
+}
+
+// only runs once per frame, so the divisions here don't touch the per-pulse path
+void ir_tracker_update(struct ir_tracker *tracker, const struct ir_timing *nominal,
+                const struct ir_frame *frame, int decoded) {
+        enum IR_PROTOCOL protocol = frame->protocol;
+        uint8_t sym;
+
+        if (protocol == kIrUnknown) {
+                return;
+        }
+
+        if (!decoded) {
+                if (++tracker->misses[protocol] < kMissesToReset) {
+                        return;
+                }
+                tracker->scale_q8[protocol] = kScaleOne; // lost it, start over
+                tracker->good[protocol] = 0;
+                tracker->misses[protocol] = 0;
+        } else {
+                // the nec repeat code carries no data worth tracking
+                if (frame->repeat && protocol == kIrNec) {
+                        return;
+                }
+                tracker->misses[protocol] = 0;
+                if (tracker->good[protocol] < kGoodToLock) {
+                        tracker->good[protocol]++;
+                }
+                // speed_q8 is against the windows decoded with, already scaled:
+                // back to the nominal table, then a moving average, 1/4 of it
+                uint16_t measured = ((uint32_t)frame->speed_q8 * tracker->scale_q8[protocol]) >> 8;
+                int16_t error = (int16_t)measured - (int16_t)tracker->scale_q8[protocol];
+                tracker->scale_q8[protocol] += error / 4;
+        }
+
+        uint16_t scale = tracker->scale_q8[protocol];
+        unsigned char locked = tracker->good[protocol] >= kGoodToLock;
+        for (sym = 0; sym < kIrSymbolCount; sym++) {
+                if (!(kSymbolProtocols[sym] & (1 << protocol))) {
+                        continue;
+                }
+                uint32_t centre = ((uint32_t)nominal->w[sym].min + nominal->w[sym].max) >> 1;
+                centre = (centre * scale) >> 8;
+                uint32_t half = locked ? centre * 3 / 20 : centre / 5; // +-15% once locked
+                tracker->timing.w[sym].min = centre - half;
+                tracker->timing.w[sym].max = centre + half > 0xffff ? 0xffff : centre + half;
+        }
+}
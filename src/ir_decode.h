@@ -0,0 +1,133 @@
+#ifndef IR_DECODE_H
+#define IR_DECODE_H
+
+#include <stdint.h>
+
+enum IR_PROTOCOL {
+        kIrUnknown = 0,
+        kIrSamsung,
+        kIrNec,
+        kIrRc5,
+        kIrRc6,
+        kIrSony,
+        kIrProtocolCount
+};
+
+// tolerance windows (+-20%) of every timing the decoders classify
+enum IR_SYMBOL {
+        kSymSamsungHdr = 0,     // header mark and space
+        kSymNecHdrMark,
+        kSymNecHdrSpace,
+        kSymNecRepeatSpace,
+        kSymBitMark,            // pulse distance protocols (samsung, nec)
+        kSymZeroSpace,
+        kSymOneSpace,
+        kSymSonyHdr,
+        kSymSonyUnit,
+        kSymSonyOne,
+        kSymRc5Half,            // 1 and 2 half bits, must stay in order
+        kSymRc5Full,
+        kSymRc6HdrMark,
+        kSymRc6HdrSpace,
+        kSymRc6Unit1,           // 1, 2 and 3 units, must stay in order
+        kSymRc6Unit2,
+        kSymRc6Unit3,
+        kIrSymbolCount
+};
+
+struct ir_window {
+        uint16_t min;   // exclusive, in timer ticks
+        uint16_t max;   // exclusive, in timer ticks
+};
+
+struct ir_timing {
+        struct ir_window w[kIrSymbolCount];
+};
+
+/*
+ * windows are computed by the preprocessor for the tick rate of the capture
+ * timer (fcy / prescaler), so decoding only does integer compares on raw ticks:
+ *   static const struct ir_timing kTiming = IR_TIMING_TABLE(4000000UL);
+ *   IR_TIMING_CHECK(4000000UL);
+ * ticks are 16 bit and the widest window edge is the nec header mark + 20%,
+ * 10.8ms, so the tick rate can be at most ~6MHz. IR_TIMING_CHECK stops the
+ * build above that instead of letting the windows wrap
+ */
+#define IR_US_TO_TICKS(us, tick_hz) \
+        ((uint16_t)(((uint32_t)(us) * ((tick_hz) / 1000UL)) / 1000UL))
+#define IR_TIMING_CHECK(tick_hz) \
+        typedef char ir_timing_fits_16_bits \
+                [10800UL * ((tick_hz) / 1000UL) / 1000UL <= 0xffff ? 1 : -1]
+#define IR_WINDOW(us, tick_hz) \
+        { IR_US_TO_TICKS((us) * 4UL / 5, tick_hz), IR_US_TO_TICKS((us) * 6UL / 5, tick_hz) }
+#define IR_TIMING_TABLE(tick_hz) { {                            \
+        IR_WINDOW(4500, tick_hz),       /* kSymSamsungHdr */    \
+        IR_WINDOW(9000, tick_hz),       /* kSymNecHdrMark */    \
+        IR_WINDOW(4500, tick_hz),       /* kSymNecHdrSpace */   \
+        IR_WINDOW(2250, tick_hz),       /* kSymNecRepeatSpace */\
+        IR_WINDOW(560, tick_hz),        /* kSymBitMark */       \
+        IR_WINDOW(560, tick_hz),        /* kSymZeroSpace */     \
+        IR_WINDOW(1690, tick_hz),       /* kSymOneSpace */      \
+        IR_WINDOW(2400, tick_hz),       /* kSymSonyHdr */       \
+        IR_WINDOW(600, tick_hz),        /* kSymSonyUnit */      \
+        IR_WINDOW(1200, tick_hz),       /* kSymSonyOne */       \
+        IR_WINDOW(889, tick_hz),        /* kSymRc5Half */       \
+        IR_WINDOW(1778, tick_hz),       /* kSymRc5Full */       \
+        IR_WINDOW(2666, tick_hz),       /* kSymRc6HdrMark */    \
+        IR_WINDOW(889, tick_hz),        /* kSymRc6HdrSpace */   \
+        IR_WINDOW(444, tick_hz),        /* kSymRc6Unit1 */      \
+        IR_WINDOW(888, tick_hz),        /* kSymRc6Unit2 */      \
+        IR_WINDOW(1332, tick_hz),       /* kSymRc6Unit3 */      \
+} }
+
+// normalized result, independent of which remote sent it
+struct ir_frame {
+        enum IR_PROTOCOL protocol;
+        uint16_t address;
+        uint16_t command;
+        unsigned char repeat;   // 1 if this is a repeat / held-button frame
+        uint32_t raw;           // bits as received, first bit in the msb for samsung
+        unsigned char deviation_pct; // worst |pulse - window centre|, in % of the centre
+        unsigned char confidence;    // 100 = dead centre, 0 = on the edge of a window
+        uint16_t speed_q8;           // measured / window centres passed in, 256 = exact
+};
+
+/*
+ * the receiver's glitch filter, one edge at a time. an edge less than min_ticks
+ * after the last one cut a pulse short: both edges go and that pulse simply
+ * continues. last_edge follows the edges kept
+ */
+enum IR_EDGE {
+        kIrEdgeStored,
+        kIrEdgeOverrun,         // kept as last_edge, no room for the pulse
+        kIrEdgeGlitch,
+        kIrEdgeGlitchFirst      // right after the edge that started the frame
+};
+
+/*
+ * follows the timing of the remote actually in use: after every frame the
+ * windows of its protocol are re-centred on the measured speed, and narrowed
+ * once a few frames agreed. repeated failures fall back to the nominal table
+ */
+struct ir_tracker {
+        struct ir_timing timing;        // pass this to ir_decode
+        uint16_t scale_q8[kIrProtocolCount];
+        unsigned char good[kIrProtocolCount];
+        unsigned char misses[kIrProtocolCount];
+};
+
+/*
+ * pulses alternate mark (carrier on) and space (carrier off) durations in timer
+ * ticks, starting with the first mark. returns 1 if a frame was decoded, 0 otherwise
+ */
+int ir_decode(const uint16_t *pulses, uint8_t count, const struct ir_timing *timing,
+                struct ir_frame *frame);
+const char *ir_protocol_name(enum IR_PROTOCOL protocol);
+enum IR_EDGE ir_filter_edge(uint16_t *pulses, uint8_t *count, uint8_t max,
+                uint16_t *last_edge, uint16_t now, uint16_t min_ticks);
+
+void ir_tracker_init(struct ir_tracker *tracker, const struct ir_timing *nominal);
+void ir_tracker_update(struct ir_tracker *tracker, const struct ir_timing *nominal,
+                const struct ir_frame *frame, int decoded);
+
+#endif
@@ -0,0 +1,241 @@
+// keypad.c
+
+// libraries & header
+#include "keypad.h"
+#include "libpic30.h"
+#include "xc.h"
+
+// project files
+#include "button_state.h" // struct debouncer
+#include "CN.h"
+#include "spsc_queue.h"
+#include "Timer.h"
+
+#define EVENT_QUEUE_SIZE 8 // power of two
+
+struct keypad_pin {
+        unsigned char cn;       // columns only
+        enum CN_PORT port;
+        uint16_t mask;
+};
+
+// board wiring: rows are driven, columns read back through the pull ups
+static const struct keypad_pin kRows[KEYPAD_ROWS] = {
+        {0, kCnPortA, 1 << 0},  // pin 2 == RA0
+        {0, kCnPortA, 1 << 1},  // pin 3 == RA1
+        {0, kCnPortA, 1 << 2},  // pin 7 == RA2
+        {0, kCnPortA, 1 << 3},  // pin 8 == RA3
+};
+static const struct keypad_pin kCols[KEYPAD_COLS] = {
+        {0, kCnPortA, 1 << 4},  // pin 10 == RA4 == CN0
+        {1, kCnPortB, 1 << 4},  // pin 9 == RB4 == CN1
+        {8, kCnPortA, 1 << 6},  // pin 14 == RA6 == CN8
+        {23, kCnPortB, 1 << 7}, // pin 11 == RB7 == CN23
+};
+static const char kKeyNames[KEYPAD_ROWS * KEYPAD_COLS + 1] = "123A456B789C*0#D";
+
+// Magic Numbers
+static const uint16_t kScanTicks = 1000; // 2ms between scans, 4 agreeing scans = 6ms
+static const unsigned long kSettleCycles = 20; // 5us for a column to follow its row
+static const unsigned char kCyclesPerTick = 8; // fcy / TIMESTAMP_TICK_HZ
+
+// statics
+static struct debouncer keys = {0xffff, 0xffff, 0, 0, 0};
+static volatile unsigned char scanning = 0;
+static uint32_t wake_time = 0;
+static unsigned char wake_pending = 0; // latency not measured yet for this wake
+static volatile struct keypad_timing timing;
+
+SPSC_QUEUE(keypad_events, struct keypad_event, EVENT_QUEUE_SIZE)
+static struct keypad_events_queue events;
+
+
+
+// ************************************************************ helper functions
+static volatile unsigned int *tris(enum CN_PORT port) {
+        return port == kCnPortA ? &TRISA : &TRISB;
+}
+
+static volatile unsigned int *lat(enum CN_PORT port) {
+        return port == kCnPortA ? &LATA : &LATB;
+}
+
+// a driven row pulls the columns of its pressed keys low
+static void drive_row(unsigned char row) {
+        *lat(kRows[row].port) &= ~kRows[row].mask;
+        *tris(kRows[row].port) &= ~kRows[row].mask;
+}
+
+// undriven rows float, so they cannot short two columns together
+static void release_row(unsigned char row) {
+        *tris(kRows[row].port) |= kRows[row].mask;
+}
+
+static void idle_rows(void) {
+        unsigned char row;
+        for (row = 0; row < KEYPAD_ROWS; row++) {
+                drive_row(row); // any key now pulls its column low and wakes us
+        }
+}
+
+// columns pulled low, bit n = column n
+static uint16_t read_cols(void) {
+        uint16_t ports[kCnPortCount];
+        uint16_t cols = 0;
+        unsigned char col;
+
+        ports[kCnPortA] = PORTA;
+        ports[kCnPortB] = PORTB;
+        for (col = 0; col < KEYPAD_COLS; col++) {
+                if (!(ports[kCols[col].port] & kCols[col].mask)) {
+                        cols |= 1 << col;
+                }
+        }
+        return cols;
+}
+
+// without diodes, 3 keys on the corners of a rectangle also connect the 4th.
+// two rows sharing 2 columns means the matrix cannot tell which keys are down
+static int ghosted(const uint16_t *row_cols) {
+        unsigned char i;
+        unsigned char j;
+        for (i = 0; i < KEYPAD_ROWS; i++) {
+                for (j = i + 1; j < KEYPAD_ROWS; j++) {
+                        uint16_t shared = row_cols[i] & row_cols[j];
+                        if (shared & (shared - 1)) {
+                                return 1;
+                        }
+                }
+        }
+        return 0;
+}
+
+// one row at a time, returns the key mask
+static uint16_t scan_matrix(uint16_t *row_cols) {
+        uint16_t sample = 0;
+        unsigned char row;
+
+        for (row = 0; row < KEYPAD_ROWS; row++) {
+                release_row(row);
+        }
+        for (row = 0; row < KEYPAD_ROWS; row++) {
+                drive_row(row);
+                __delay32(kSettleCycles);
+                row_cols[row] = read_cols();
+                release_row(row);
+                sample |= row_cols[row] << (row * KEYPAD_COLS);
+        }
+        return sample;
+}
+
+
+
+// ********************************************************************* scanning
+static void scan_callback(void);
+
+// a key went down while idle: scan until it settles
+static void wake(void) {
+        scanning = 1;
+        timing.wakes++;
+        wake_time = get_timestamp_t3();
+        wake_pending = 1;
+        arm_oneshot_t2(kScanTicks, scan_callback);
+}
+
+static void scan_callback(void) {
+        uint16_t row_cols[KEYPAD_ROWS];
+        uint16_t t0 = get_timestamp_t3();
+
+        uint16_t sample = scan_matrix(row_cols);
+        if (ghosted(row_cols)) {
+                timing.ghosted_scans++;
+                sample = keys.state; // keep what we had until it is unambiguous
+        }
+        debouncer_update(&keys, sample);
+
+        uint32_t cycles = (uint32_t)(uint16_t)(get_timestamp_t3() - t0) * kCyclesPerTick;
+        if (cycles > timing.scan_cycles_max) {
+                timing.scan_cycles_max = cycles;
+        }
+
+        if (keys.just_pressed || keys.just_released) {
+                struct keypad_event event;
+                event.just_pressed = keys.just_pressed;
+                event.just_released = keys.just_released;
+                event.pressed = keys.state;
+                event.timestamp = get_timestamp_t3();
+                keypad_events_push(&events, &event);
+
+                if (keys.just_pressed && wake_pending) {
+                        wake_pending = 0;
+                        cycles = (event.timestamp - wake_time) * kCyclesPerTick;
+                        timing.latency_cycles_last = cycles;
+                        if (cycles > timing.latency_cycles_max) {
+                                timing.latency_cycles_max = cycles;
+                        }
+                }
+        }
+
+        // keep scanning while a key is down or a counter is running
+        if (keys.state || ~(keys.cnt0 & keys.cnt1)) {
+                arm_oneshot_t2(kScanTicks, scan_callback);
+                return;
+        }
+
+        // the CN isr ignores columns while scanning is set, so a key hit as
+        // the rows go back low would be lost: idle them with CN held off and
+        // look at the columns once more before going to sleep
+        unsigned char ipl = SRbits.IPL;
+        SRbits.IPL = IPC4bits.CNIP;
+        idle_rows();
+        __delay32(kSettleCycles);
+        if (read_cols()) {
+                wake();
+        } else {
+                scanning = 0; // next column edge wakes us again
+        }
+        SRbits.IPL = ipl;
+}
+
+// a column went low while idle: a key was hit
+static void keypad_cn_handler(unsigned char level, uint16_t timestamp) {
+        if (scanning) {
+                return; // the scan itself moves the columns
+        }
+        wake();
+}
+
+
+
+// *************************************************************** API functions
+void keypad_init(void) {
+        unsigned char i;
+
+        debouncer_init(&keys, 0);
+        AD1PCFG |= 0x0003; // RA0 / RA1 are AN0 / AN1, make them digital
+        for (i = 0; i < KEYPAD_COLS; i++) {
+                cn_register(kCols[i].cn, kCols[i].port, kCols[i].mask, kCnPullUp,
+                                keypad_cn_handler);
+        }
+        idle_rows();
+}
+
+int keypad_get_event(struct keypad_event *event) {
+        return keypad_events_pop(&events, event);
+}
+
+uint16_t keypad_pressed(void) {
+        return keys.state;
+}
+
+char keypad_key_name(unsigned char key) {
+        return key < KEYPAD_ROWS * KEYPAD_COLS ? kKeyNames[key] : '?';
+}
+
+void keypad_get_timing(struct keypad_timing *out) {
+        unsigned char ipl = SRbits.IPL;
+        SRbits.IPL = 7; // the scan timer writes it
+        *out = timing;
+        SRbits.IPL = ipl;
+        out->dropped = events.dropped;
+}
@@ -0,0 +1,35 @@
+// keypad.h
+#ifndef KEYPAD_H
+#define KEYPAD_H
+
+#include <stdint.h>
+
+#define KEYPAD_ROWS 4
+#define KEYPAD_COLS 4
+#define KEYPAD_KEY(row, col) ((row) * KEYPAD_COLS + (col)) // bit in the key masks
+
+// same masks as the buttons, one bit per key, from a struct debouncer
+struct keypad_event {
+        uint16_t just_pressed;
+        uint16_t just_released;
+        uint16_t pressed;       // every key down after this change
+        uint32_t timestamp;     // timer 3 ticks
+};
+
+// worst cases, in instruction cycles
+struct keypad_timing {
+        uint32_t scan_cycles_max;       // one scan of the whole matrix
+        uint32_t latency_cycles_max;    // column edge to the key press event
+        uint32_t latency_cycles_last;
+        uint16_t wakes;
+        uint16_t ghosted_scans;         // 3 keys on a rectangle, scan thrown away
+        uint16_t dropped;               // events lost, the main loop fell behind
+};
+
+void keypad_init(void); // call CN_init first
+int keypad_get_event(struct keypad_event *event); // only from the main loop
+uint16_t keypad_pressed(void);
+char keypad_key_name(unsigned char key);
+void keypad_get_timing(struct keypad_timing *out);
+
+#endif
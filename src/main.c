@@ -19,11 +19,19 @@
 
 // project files
 #include "ADC.h"
+#include "adc_uart.h"
 #include "ChangeClk.h"
+#include "CN.h"
 #include "comparator.h"
+#include "cvref.h"
+#include "dsp_filter.h"
+#include "encoder.h"
 #include "IO.h"
 #include "IR.h"
+#include "keypad.h"
+#include "pulse.h"
 #include "samsung_rx.h"
+#include "scope.h"
 #include "SenseCapApp.h"
 #include "Timer.h"
 #include "UART2.h"
@@ -142,9 +150,26 @@ static inline void begin_btn_debug_mode(void) {
         INTCON1bits.NSTDIS = kEnableNesting; // enable nesting interrupts
         set_btn_verbose_mode(kEnable);
         CN_init();
+        btn_init();
 
+        struct btn_timing timing;
+        uint16_t edges_seen = 0;
         while(1) {
                 Idle();
+                process_btn_events();
+
+                get_btn_timing(&timing);
+                if (timing.edges != edges_seen) {
+                        edges_seen = timing.edges;
+                        Disp2String("\n\risr cycles max:");
+                        Disp2Hex32(timing.isr_cycles_max);
+                        Disp2String("sample cycles max:");
+                        Disp2Hex32(timing.sample_cycles_max);
+                        Disp2String("bounces:");
+                        Disp2Hex(timing.bounces);
+                        Disp2String("dropped:");
+                        Disp2Hex(timing.dropped);
+                }
         }
 }
 
@@ -154,13 +179,567 @@ Assignment 3
         and envelope.
 */
 static inline void begin_samsung_xmitter(void) {
+        set_btn_xmit_mode(kEnable);
         CN_init();
+        btn_init();
         LATBbits.LATB9 = 0;
         // set_btn_verbose_mode(kEnable);
         delay_us_t1(1); // hack to setup the timer TODO
 
         while(1) {
                 Idle();
+                process_btn_events();
+        }
+}
+
+/*
+Encoder
+        volume on a rotary encoder, turning faster sends more steps per detent
+*/
+static inline void begin_encoder_volume(void) {
+        CN_init();
+        encoder_init();
+        LATBbits.LATB9 = 0;
+        delay_us_t1(1); // hack to setup the timer TODO
+
+        while(1) {
+                Idle();
+
+                int16_t delta = encoder_take_delta();
+                for (; delta > 0; delta--) {
+                        xmit_samsung_signal(kVolumeUpBits);
+                }
+                for (; delta < 0; delta++) {
+                        xmit_samsung_signal(kVolumeDownBits);
+                }
+        }
+}
+
+/*
+Keypad
+        4x4 matrix instead of the three buttons: rows idle low, a key pulls its
+        column low and the CN interrupt wakes us for a short scan burst
+*/
+static inline void begin_keypad_mode(void) {
+        struct keypad_event event;
+        struct keypad_timing timing;
+        unsigned char key;
+
+        CN_init();
+        keypad_init();
+
+        while(1) {
+                Idle();
+
+                while (keypad_get_event(&event)) {
+                        for (key = 0; key < KEYPAD_ROWS * KEYPAD_COLS; key++) {
+                                if (event.just_pressed & (1u << key)) {
+                                        XmitUART2('\r', 1);
+                                        XmitUART2('\n', 1);
+                                        XmitUART2(keypad_key_name(key), 1);
+                                }
+                        }
+                        keypad_get_timing(&timing);
+                        Disp2String(" scan cycles max:");
+                        Disp2Hex32(timing.scan_cycles_max);
+                        Disp2String("latency:");
+                        Disp2Hex32(timing.latency_cycles_last);
+                        Disp2String("max:");
+                        Disp2Hex32(timing.latency_cycles_max);
+                        Disp2String("ghosts:");
+                        Disp2Hex(timing.ghosted_scans);
+                }
+        }
+}
+
+/*
+CVREF calibration
+        measures all 32 ladder codes against the band gap, stores them in data
+        eeprom and prints measured mV and residual per code
+*/
+static inline void begin_cvref_calibration(void) {
+        cvref_init();
+        if (!cvref_calibrate()) {
+                Disp2String("\n\rcvref calibration failed, adc busy or no band gap reading");
+        }
+        cmp_refresh_thresholds();
+        cvref_print_report();
+
+        while(1) {
+                Idle();
+        }
+}
+
+/*
+Comparator thresholds
+        slow or noisy input on the comparator with 100mV of hysteresis around
+        1.2V: prints events, real crossings and spurious events every second
+*/
+static inline void begin_comparator_stats(void) {
+        static const struct cmp_config kHysteresis = {kCmpHysteresis, 1150, 1250, 0, 200};
+        struct cmp_stats stats;
+
+        ComparatorInit();
+        cmp_configure(&kHysteresis);
+
+        uint32_t second = get_timestamp_t3();
+        while(1) {
+                Idle();
+                if (get_timestamp_t3() - second < TIMESTAMP_TICK_HZ) {
+                        continue;
+                }
+                second += TIMESTAMP_TICK_HZ;
+
+                cmp_get_stats(&stats);
+                Disp2String("\n\revents:");
+                Disp2Dec((unsigned int)stats.events);
+                Disp2String("crossings:");
+                Disp2Dec((unsigned int)stats.crossings);
+                Disp2String("spurious:");
+                Disp2Dec((unsigned int)stats.spurious);
+                cmp_clear_stats();
+        }
+}
+
+/*
+Converter benchmark
+        the same input on the comparator and on AN5 (pin 8): mean time per
+        conversion of the cvref binary search and of the adc, and both
+        readings. energy per conversion is the module's current (datasheet
+        delta currents for the adc, the comparator and CVREF) times the time
+        printed here; the adc is only on for its conversion, the comparator
+        and CVREF stay on between searches
+*/
+#define BENCH_CONVERSIONS 64
+
+static inline void begin_converter_benchmark(void) {
+        struct cmp_conversion conversion;
+        unsigned int adc_value = 0;
+        uint32_t start;
+        uint32_t cmp_ticks;
+        uint32_t adc_ticks;
+        unsigned char i;
+
+        start_timestamp_t3();
+        ComparatorInit();
+        divider_set_mode(kDividerOff);
+        init_ADC();
+
+        while(1) {
+                start = get_timestamp_t3();
+                for (i = 0; i < BENCH_CONVERSIONS; i++) {
+                        cmp_convert(&conversion);
+                }
+                cmp_ticks = get_timestamp_t3() - start;
+
+                start = get_timestamp_t3();
+                for (i = 0; i < BENCH_CONVERSIONS; i++) {
+                        adc_value = read_ADC();
+                }
+                adc_ticks = get_timestamp_t3() - start;
+
+                Disp2String("\n\rcvref search us:");
+                Disp2Dec(cmp_ticks * (US_PER_S / TIMESTAMP_TICK_HZ) / BENCH_CONVERSIONS);
+                Disp2String("mV:");
+                Disp2Dec(conversion.mv);
+                Disp2String("adc us:");
+                Disp2Dec(adc_ticks * (US_PER_S / TIMESTAMP_TICK_HZ) / BENCH_CONVERSIONS);
+                Disp2String("code:");
+                Disp2Dec(adc_value);
+        }
+}
+
+/*
+Frequency meter
+        comparator input (CVREF threshold) measured over a 1s gate, printed in
+        Hz * 10 after every gate
+*/
+static inline void begin_freq_meter(void) {
+        struct freq_result result;
+
+        CVREFinit(1.5);
+        ComparatorInit();
+        freq_start(0);
+
+        while(1) {
+                Idle();
+
+                if (freq_get(&result)) {
+                        Disp2String("\n\rHz*10:");
+                        Disp2Hex32(result.value);
+                        Disp2String(result.mode == kFreqReciprocal ? "reciprocal" : "gated");
+                        Disp2String("periods:");
+                        Disp2Hex32(result.periods);
+                }
+        }
+}
+
+/*
+Divider benchmark
+        cpu load of each divider mode for whatever drives the comparator input:
+        counts spins of an empty loop for 1s per mode, load = lost spins
+*/
+static uint32_t spins_per_second(void) {
+        uint32_t spins = 0;
+        uint32_t start = get_timestamp_t3();
+        while (get_timestamp_t3() - start < TIMESTAMP_TICK_HZ) {
+                spins++;
+        }
+        return spins;
+}
+
+static inline void begin_divider_benchmark(void) {
+        static const enum DIVIDER_MODE kModes[] = {kDividerIsr, kDividerTimer};
+        static char *const kNames[] = {"isr", "timer"};
+        uint32_t idle;
+        unsigned char i;
+
+        CVREFinit(1.5);
+        ComparatorInit();
+        divider_set_target(10);
+        start_timestamp_t3();
+
+        while(1) {
+                divider_set_mode(kDividerOff);
+                idle = spins_per_second();
+                for (i = 0; i < 2; i++) {
+                        Disp2String("\n\rdivider:");
+                        Disp2String(kNames[i]);
+                        if (!divider_set_mode(kModes[i])) {
+                                Disp2String("T1CK (RA4) is a CN pin");
+                                continue;
+                        }
+                        uint32_t spins = spins_per_second();
+                        Disp2String("load %:");
+                        Disp2Dec(spins < idle ? (unsigned int)(100 - spins * 100 / idle) : 0);
+                }
+        }
+}
+
+/*
+Pulse meter
+        comparator output jumpered to T1CK: duty cycle and mean pulse width
+        from timer 1 gate accumulation, no interrupt per edge
+*/
+static inline void begin_pulse_meter(void) {
+        struct pulse_result result;
+
+        CVREFinit(1.5);
+        ComparatorInit();
+        divider_set_mode(kDividerOff);
+        if (!pulse_start(100)) {
+                Disp2String("\n\rpulse meter: T1CK (RA4) is a CN pin");
+        }
+
+        while(1) {
+                Idle();
+
+                if (pulse_get(&result)) {
+                        Disp2String("\n\rduty /1000:");
+                        Disp2Dec(result.duty_permille);
+                        Disp2String("mean width ns:");
+                        Disp2Hex32(result.mean_width_ns);
+                        Disp2String("pulses:");
+                        Disp2Hex32(result.pulses);
+                }
+        }
+}
+
+// oversampling on a simulated input: a slow ramp in 1/256 lsb steps plus
+// triangular noise of up to an lsb, rounded to a code like the adc does. per
+// ratio the mean error against the ramp, then the rate the real adc manages
+#define SIM_POINTS 64
+#define RATE_READINGS 16 // timed together, one is too short to time at ratio 1
+static uint16_t noise_state = 0xace1;
+
+static uint16_t xorshift16(void) {
+        noise_state ^= noise_state << 7;
+        noise_state ^= noise_state >> 9;
+        noise_state ^= noise_state << 8;
+        return noise_state;
+}
+
+static uint16_t sim_convert(uint32_t truth_256) {
+        int32_t v = (int32_t)truth_256 + (xorshift16() & 0xff) + (xorshift16() & 0xff) - 255;
+
+        v = (v + 128) >> 8;
+        return v < 0 ? 0 : (v > 1023 ? 1023 : v);
+}
+
+static inline void begin_oversampling_benchmark(void) {
+        uint32_t truth;
+        uint32_t sum;
+        uint32_t estimate;
+        uint32_t error_sum;
+        uint32_t start;
+        uint32_t ticks;
+        uint16_t value;
+        uint16_t n;
+        unsigned char point;
+        unsigned char bits;
+
+        start_timestamp_t3();
+        init_ADC();
+
+        while(1) {
+                for (bits = 0; bits <= ADC_MAX_EXTRA_BITS; bits++) {
+                        error_sum = 0;
+                        for (point = 0; point < SIM_POINTS; point++) {
+                                truth = 300ul * 256 + point * 37; // ~9 codes in uneven steps
+                                sum = 0;
+                                for (n = 1u << (2 * bits); n; n--) {
+                                        sum += sim_convert(truth);
+                                }
+                                estimate = (uint32_t)adc_decimate(sum, bits) << (8 - bits);
+                                error_sum += estimate > truth ? estimate - truth : truth - estimate;
+                        }
+
+                        start = get_timestamp_t3();
+                        for (n = RATE_READINGS; n; n--) {
+                                value = read_ADC_oversampled(bits);
+                        }
+                        ticks = get_timestamp_t3() - start;
+
+                        Disp2String("\n\rbits:");
+                        Disp2Dec(10 + bits);
+                        Disp2String("ratio:");
+                        Disp2Dec(1u << (2 * bits));
+                        Disp2String("mean error /1000 lsb:");
+                        Disp2Dec(error_sum * 1000 / 256 / SIM_POINTS);
+                        Disp2String("readings/s:");
+                        Disp2Hex32(ticks ? RATE_READINGS * TIMESTAMP_TICK_HZ / ticks : 0);
+                        Disp2String("adc:");
+                        Disp2Dec(value);
+                }
+        }
+}
+
+// AN5 at exactly 1kHz off the timer 3 match, stats once a second. the printing
+// only delays when blocks are taken, not when samples are
+static inline void begin_fixed_rate_capture(void) {
+        static const struct adc_acq_config kCapture = {5, 31, 7, 1000};
+        struct adc_acq_stats stats;
+        struct adc_block block;
+        uint32_t sum = 0;
+        uint16_t blocks_taken = 0;
+        unsigned char i;
+
+        TRISAbits.TRISA3 = 1;
+        adc_acq_start(&kCapture);
+
+        while(1) {
+                Idle();
+
+                while (adc_get_block(&block)) {
+                        for (i = 0; i < ADC_BLOCK; i++) {
+                                sum += block.samples[i];
+                        }
+                        blocks_taken++;
+                }
+                if (blocks_taken < 125) {
+                        continue;
+                }
+
+                adc_acq_get_stats(&stats);
+                Disp2String("\n\rmean:");
+                Disp2Dec(sum / (blocks_taken * ADC_BLOCK));
+                Disp2String("mHz:");
+                Disp2Hex32(stats.rate_mhz);
+                Disp2String("jitter us: -");
+                Disp2Dec(stats.jitter_min_us < 0 ? -stats.jitter_min_us : 0);
+                Disp2String("+");
+                Disp2Dec(stats.jitter_max_us > 0 ? stats.jitter_max_us : 0);
+                Disp2String("overruns:");
+                Disp2Dec(stats.overruns);
+                Disp2String("dropped:");
+                Disp2Dec(stats.dropped);
+                sum = 0;
+                blocks_taken = 0;
+        }
+}
+
+// the 1kHz capture through three filters side by side: a median of 3 into a
+// 1/16 iir, a moving average of 32, and a 3rd order cic down to 62.5Hz
+static inline void begin_filtered_capture(void) {
+        static const struct adc_acq_config kCapture = {5, 31, 7, 1000};
+        struct dsp_filter spikes;
+        struct dsp_filter smooth;
+        struct dsp_filter average;
+        struct dsp_filter cic;
+        struct adc_block block;
+        uint16_t filtered[ADC_BLOCK];
+        uint16_t raw = 0;
+        uint16_t smoothed = 0;
+        uint16_t averaged = 0;
+        uint16_t decimated = 0;
+        uint16_t blocks_taken = 0;
+        unsigned char count;
+
+        dsp_filter_init(&spikes, kDspMedian, 3);
+        dsp_filter_init(&smooth, kDspIir, 4);
+        dsp_filter_init(&average, kDspMovingAverage, 5);
+        dsp_filter_init(&cic, kDspCic, (3 << 4) | 4);
+        TRISAbits.TRISA3 = 1;
+        adc_acq_start(&kCapture);
+
+        while(1) {
+                Idle();
+
+                while (adc_get_block(&block)) {
+                        raw = block.samples[ADC_BLOCK - 1];
+                        count = dsp_filter_block(&average, block.samples, ADC_BLOCK, filtered);
+                        averaged = filtered[count - 1];
+                        if (dsp_filter_block(&cic, block.samples, ADC_BLOCK, filtered)) {
+                                decimated = filtered[0]; // 8 in, at most one out
+                        }
+                        dsp_filter_block(&spikes, block.samples, ADC_BLOCK, block.samples);
+                        dsp_filter_block(&smooth, block.samples, ADC_BLOCK, block.samples);
+                        smoothed = block.samples[ADC_BLOCK - 1];
+                        blocks_taken++;
+                }
+                if (blocks_taken < 125) {
+                        continue;
+                }
+
+                Disp2String("\n\rraw:");
+                Disp2Dec(raw);
+                Disp2String("median + iir:");
+                Disp2Dec(smoothed);
+                Disp2String("average:");
+                Disp2Dec(averaged);
+                Disp2String("cic:");
+                Disp2Dec(decimated);
+                blocks_taken = 0;
+        }
+}
+
+// AN5 at 4kHz streamed for 2s at every supported baud rate, then a report at
+// 9600: the packets are binary, the report lines are what a terminal shows
+#define STREAM_RATE_HZ 4000
+static inline void begin_uart_stream_benchmark(void) {
+        struct adc_uart_stats stats;
+        unsigned long baud;
+        uint32_t start;
+        unsigned char i;
+
+        TRISAbits.TRISA3 = 1;
+        start_timestamp_t3();
+
+        while(1) {
+                for (i = 0; (baud = UART2BaudAt(i)) != 0; i++) {
+                        adc_uart_start(5, STREAM_RATE_HZ, baud);
+                        start = get_timestamp_t3();
+                        while (get_timestamp_t3() - start < 2 * TIMESTAMP_TICK_HZ) {
+                                adc_uart_poll();
+                                Idle(); // the adc or uart interrupt wakes us
+                        }
+                        adc_uart_stop();
+                        adc_uart_get_stats(&stats);
+
+                        Disp2String("\n\rbaud /100:");
+                        Disp2Dec(baud / 100);
+                        Disp2String("samples/s:");
+                        Disp2Dec(stats.sent_per_s);
+                        Disp2String("of:");
+                        Disp2Dec(STREAM_RATE_HZ);
+                        Disp2String("dropped packets:");
+                        Disp2Dec(stats.dropped);
+                        Disp2String("adc blocks lost:");
+                        Disp2Dec(stats.adc_dropped);
+                }
+        }
+}
+
+// two voltage channels scanned at a fixed aggregate rate, a capacitance burst
+// in between every 2048 scans. the bursts pause the scan, see pauses
+static inline void begin_scan_with_capacitance(void) {
+        static const struct adc_scan_config kScan = {
+                .channels = {
+                        {5, 1},         // pin 8 == RA3 == AN5, every scan
+                        {12, 4},        // pin 15 == RB12 == AN12, every 4th
+                },
+                .count = 2,
+                .samc = 31,
+                .adcs = 63,             // 43 TAD of 16us: ~1450 conversions/s
+        };
+        struct adc_scan_stats stats;
+        uint32_t sums[2] = {0, 0};
+        uint16_t counts[2] = {0, 0};
+        uint32_t next_burst = 2048;
+        uint16_t sample;
+        unsigned char i;
+
+        TRISAbits.TRISA3 = 1;
+        TRISBbits.TRISB12 = 1;
+        CTMUinit();
+        adc_scan_start(&kScan);
+
+        while(1) {
+                Idle();
+
+                for (i = 0; i < kScan.count; i++) {
+                        while (adc_scan_read(i, &sample)) {
+                                sums[i] += sample;
+                                counts[i]++;
+                        }
+                }
+
+                adc_scan_get_stats(&stats);
+                if (stats.scans < next_burst) {
+                        continue;
+                }
+                next_burst = stats.scans + 2048;
+
+                for (i = 0; i < kScan.count; i++) {
+                        Disp2String(i ? "AN12 mean:" : "\n\rAN5 mean:");
+                        Disp2Dec(counts[i] ? sums[i] / counts[i] : 0);
+                        Disp2String("samples:");
+                        Disp2Dec(counts[i]);
+                        sums[i] = 0;
+                        counts[i] = 0;
+                }
+                Disp2String("dropped:");
+                Disp2Dec(stats.dropped);
+                Disp2String("pauses:");
+                Disp2Dec(stats.pauses);
+                sample_capacitance_adaptive();
+        }
+}
+
+// AN5 at 4kHz, captured around every rising comparator crossing (hysteresis
+// as in begin_comparator_stats): 16 samples before it, 47 after, sent as text
+static inline void begin_scope_capture(void) {
+        static const struct cmp_config kHysteresis = {kCmpHysteresis, 1150, 1250, 0, 200};
+        static const struct scope_config kScope = {
+                .channel = 5,
+                .rate_hz = 4000,
+                .trigger = kScopeComparator,
+                .falling = 0,
+                .pre = 16,
+                .post = 47,
+        };
+        struct scope_stats stats;
+
+        TRISAbits.TRISA3 = 1;
+        start_timestamp_t3();
+        ComparatorInit();
+        cmp_configure(&kHysteresis);
+        scope_start(&kScope);
+
+        while(1) {
+                Idle(); // the adc interrupt wakes us every block
+                scope_poll();
+                if (scope_state() != kScopeFrozen) {
+                        continue;
+                }
+                scope_dump();
+                scope_get_stats(&stats);
+                Disp2String("\n\rcaptures:");
+                Disp2Dec(stats.captures);
+                Disp2String("gaps:");
+                Disp2Dec(stats.gaps);
+                Disp2String("missed:");
+                Disp2Dec(stats.missed);
         }
 }
 
@@ -172,6 +751,11 @@ static inline void uart_sanity_test(void) {
 }
 
 // ************************************************************************ main
+// RAM is 1536 bytes. the project puts every function and variable in its own
+// section and drops the unused ones, so a demo only links the drivers it calls:
+// begin_scope_capture, the largest, keeps under 1KB of statics (919 bytes in a
+// host link with 8 byte pointers), the rest is stack. with every driver linked
+// their buffers would not fit, keep remove-unused-sections on
 int main(void) { // runs at 1st power-up automatically
         init_clock(8); //starts the clock
         uart_sanity_test();
@@ -18,6 +18,7 @@
 
 // driver code
 #include "ChangeClk.h"
+#include "CN.h"
 #include "IR.h"
 #include "samsung_rx.h"
 #include "Timer.h"
@@ -103,12 +104,51 @@ static inline void init_clock(unsigned int freq) { // shared code
         NewClk(freq); // Switch clock: 32 for 32kHz, 500 for 500 kHz, 8 for 8MHz
 }
 
+static void print_rx_stats(void) {
+        struct ir_rx_stats stats;
+        ir_rx_get_stats(&stats);
+
+        Disp2String(" frames:");
+        Disp2Hex(stats.frames);
+        Disp2String("errors:");
+        Disp2Hex(stats.decode_errors);
+        Disp2String("dropped:");
+        Disp2Hex(stats.dropped);
+        Disp2String("overruns:");
+        Disp2Hex(stats.overruns);
+        Disp2String("glitches:");
+        Disp2Hex(stats.glitches);
+        Disp2String("noise:");
+        Disp2Hex(stats.noise_frames);
+        Disp2String("marginal:");
+        Disp2Hex(stats.low_confidence);
+        Disp2String("slots used:");
+        Disp2Hex(stats.slots_high_water);
+}
+
 // ************************************************************************ main
 int main(void) { // runs at 1st power-up automatically
+        struct ir_command command;
+        uint16_t repeats_seen = 0;
+
         init_clock(8);
         CN_init();
+        ir_rx_init();
 
+        // the receiver isrs only capture, decoding and printing happen here
         while(1) {
+                while (ir_rx_get_command(&command)) {
+                        ir_rx_print_command(&command);
+                        print_rx_stats();
+                }
+
+                uint16_t repeats = ir_rx_repeat_count();
+                if (repeats != repeats_seen) {
+                        Disp2String(" held x");
+                        Disp2Hex(repeats - repeats_seen);
+                        repeats_seen = repeats;
+                }
+
                 Idle();
         }
         return 0;
@@ -0,0 +1,165 @@
+// pulse.c
+
+// libraries & header
+#include "pulse.h"
+#include "xc.h"
+
+// project files
+#include "CN.h"
+#include "IR.h" // timer 1
+#include "Timer.h"
+
+#define FCY_HZ 4000000UL // 8MHz clock, see TIMESTAMP_TICK_HZ
+#define MAX_LAP_TICKS 60000 // per lap of the window one shot (120ms)
+#define MAX_WINDOW_MS 4000 // 0xffff counts at 1:256
+
+// Magic Numbers
+static const unsigned char kCyclesPerTick = FCY_HZ / TIMESTAMP_TICK_HZ;
+static const unsigned char kPrescalerShift[4] = {0, 3, 6, 8}; // TCKPS 1:1, 1:8, 1:64, 1:256
+static const uint16_t kCountLap = 0xffff; // edges per overflow callback while counting
+
+enum PULSE_PHASE {
+        kPulseIdle = 0,
+        kPulseGating,
+        kPulseCounting
+};
+
+// statics, the one shot callback owns them while running
+static volatile enum PULSE_PHASE phase = kPulseIdle;
+static unsigned char prescaler = 0;
+static uint32_t window_ticks = 0;
+static uint32_t ticks_left = 0;
+static uint32_t phase_start = 0;
+static uint16_t count_laps = 0;
+static uint32_t high_cycles = 0;
+static uint32_t gate_ticks = 0;
+static volatile unsigned char ready = 0;
+static struct pulse_window {
+        uint32_t high_cycles;
+        uint32_t gate_ticks;
+        uint32_t edges;
+        uint32_t count_ticks;
+} window;
+
+
+
+// ************************************************************ helper functions
+static void count_lap(void) {
+        count_laps++;
+}
+
+static void phase_callback(void);
+
+static void start_phase(enum PULSE_PHASE next) {
+        phase = next;
+        if (next == kPulseGating) {
+                gate_t1(prescaler);
+        } else {
+                count_laps = 0;
+                count_edges_t1(kCountLap, count_lap);
+        }
+        phase_start = get_timestamp_t3();
+        ticks_left = window_ticks;
+        arm_oneshot_t2(ticks_left > MAX_LAP_TICKS ? MAX_LAP_TICKS : ticks_left, phase_callback);
+}
+
+// window one shot: another lap, or read timer 1 and switch over
+static void phase_callback(void) {
+        if (phase == kPulseIdle) {
+                return;
+        }
+        if (ticks_left > MAX_LAP_TICKS) {
+                ticks_left -= MAX_LAP_TICKS;
+                arm_oneshot_t2(ticks_left > MAX_LAP_TICKS ? MAX_LAP_TICKS : ticks_left,
+                                phase_callback);
+                return;
+        }
+
+        uint16_t counted = stop_t1();
+        uint32_t elapsed = get_timestamp_t3() - phase_start;
+
+        if (phase == kPulseGating) {
+                high_cycles = (uint32_t)counted << kPrescalerShift[prescaler];
+                gate_ticks = elapsed;
+                start_phase(kPulseCounting);
+                return;
+        }
+
+        window.high_cycles = high_cycles;
+        window.gate_ticks = gate_ticks;
+        window.edges = (uint32_t)count_laps * kCountLap + counted;
+        window.count_ticks = elapsed;
+        ready = 1;
+        start_phase(kPulseGating);
+}
+
+
+
+// *************************************************************** API functions
+int pulse_start(uint16_t window_ms) {
+        uint32_t window_cycles;
+
+        pulse_stop();
+        if (cn_watched(kCnPortA) & T1CK_PORTA_MASK) {
+                return 0; // checked up front, the phases switch from a one shot
+        }
+        if (window_ms == 0) {
+                window_ms = 1;
+        }
+        if (window_ms > MAX_WINDOW_MS) {
+                window_ms = MAX_WINDOW_MS;
+        }
+
+        // the smallest prescaler that can't overflow even at 100% duty
+        window_cycles = (uint32_t)window_ms * (FCY_HZ / MS_PER_S);
+        prescaler = 0;
+        while (prescaler < 3 && (window_cycles >> kPrescalerShift[prescaler]) > 0xfff0) {
+                prescaler++;
+        }
+
+        start_timestamp_t3();
+        window_ticks = (uint32_t)window_ms * (TIMESTAMP_TICK_HZ / MS_PER_S);
+        ready = 0;
+        start_phase(kPulseGating);
+        return 1;
+}
+
+void pulse_stop(void) {
+        phase = kPulseIdle; // a pending one shot sees this and does nothing
+        stop_t1();
+}
+
+int pulse_get(struct pulse_result *result) {
+        struct pulse_window w;
+        uint32_t gate_cycles;
+
+        if (!ready) {
+                return 0;
+        }
+        unsigned char ipl = SRbits.IPL;
+        SRbits.IPL = 7; // the one shot writes the window
+        w = window;
+        ready = 0;
+        SRbits.IPL = ipl;
+
+        gate_cycles = w.gate_ticks * kCyclesPerTick;
+        if (w.high_cycles > gate_cycles) {
+                w.high_cycles = gate_cycles; // rounding of the stop against T3
+        }
+
+        result->pulses = w.edges;
+        result->window_us = w.gate_ticks * (US_PER_S / TIMESTAMP_TICK_HZ);
+        result->high_us = w.high_cycles / (FCY_HZ / US_PER_S);
+        result->duty_permille = gate_cycles ? (uint16_t)(((uint64_t)w.high_cycles * 1000
+                        + gate_cycles / 2) / gate_cycles) : 0;
+
+        // pulses in the gating window, scaled from the counting window
+        uint64_t pulses_x_gate = (uint64_t)w.edges * w.gate_ticks;
+        if (pulses_x_gate == 0) {
+                result->mean_width_ns = 0;
+        } else {
+                uint64_t ns = (uint64_t)w.high_cycles * (1000000000UL / FCY_HZ) * w.count_ticks;
+                result->mean_width_ns = (uint32_t)((ns + pulses_x_gate / 2) / pulses_x_gate);
+        }
+        return 1;
+}
@@ -0,0 +1,28 @@
+// pulse.h
+#ifndef PULSE_H
+#define PULSE_H
+
+#include <stdint.h>
+
+/*
+ * pulse width and duty cycle of the comparator output, jumpered from C2OUT to
+ * T1CK like the timer divider. windows alternate: timer 1 gated by T1CK
+ * accumulates the high time, then counts rising edges for as long again. no
+ * interrupt per edge in either, the cpu cost is two one shot callbacks per
+ * pair of windows (plus one interrupt per 65535 edges while counting)
+ */
+struct pulse_result {
+        uint16_t duty_permille;         // high time / gate window
+        uint32_t mean_width_ns;         // high time / pulses, 0 if there were none
+        uint32_t pulses;                // rising edges in the counting window
+        uint32_t high_us;               // in the gating window
+        uint32_t window_us;
+};
+
+// takes timer 1 (and the T1CK jumper, pin 10 == RA4) from the divider. windows
+// up to 4000ms. 0 if RA4 is a CN pin in this mode (see IR.h)
+int pulse_start(uint16_t window_ms);
+void pulse_stop(void);
+int pulse_get(struct pulse_result *result); // 1 with a new result per window pair
+
+#endif
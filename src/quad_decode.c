@@ -0,0 +1,61 @@
+// quad_decode.c
+
+// libraries & header
+#include "quad_decode.h"
+
+/*
+ * gray code: index is (previous ab << 2) | ab, value the quarter step taken.
+ * no change and both pins changing (impossible, so a step was missed) are 0
+ */
+static const int8_t kQuadTable[16] = {
+         0, -1,  1,  0,
+         1,  0,  0, -1,
+        -1,  0,  0,  1,
+         0,  1, -1,  0,
+};
+
+
+
+// ************************************************************ core functions
+void quad_init(struct quad_decoder *d, unsigned char ab, uint16_t fast_ticks,
+                uint16_t medium_ticks) {
+        d->ab = ab & 3;
+        d->sub = 0;
+        d->last_detent = 0;
+        d->position = 0;
+        d->steps = 0;
+        d->errors = 0;
+        d->fast_ticks = fast_ticks;
+        d->medium_ticks = medium_ticks;
+}
+
+// returns the detents added to position (0 if this edge did not finish one)
+int8_t quad_update(struct quad_decoder *d, unsigned char ab, uint32_t timestamp) {
+        unsigned char index = (d->ab << 2) | ab;
+        int8_t step = kQuadTable[index];
+
+        if (!step) {
+                if ((d->ab ^ ab) == 3) {
+                        d->errors++;
+                        d->ab = ab;
+                }
+                return 0; // no change (the other pin's call) or missed
+        }
+
+        d->ab = ab;
+        d->steps += step;
+        d->sub += step;
+        if (d->sub > -QUAD_STEPS_PER_DETENT && d->sub < QUAD_STEPS_PER_DETENT) {
+                return 0;
+        }
+
+        // a full detent: how fast was it turned
+        uint32_t since = timestamp - d->last_detent;
+        int8_t gain = since < d->fast_ticks ? 4 : since < d->medium_ticks ? 2 : 1;
+        int8_t detent = d->sub > 0 ? gain : -gain;
+
+        d->sub = 0;
+        d->last_detent = timestamp;
+        d->position += detent;
+        return detent;
+}
@@ -0,0 +1,28 @@
+#ifndef QUAD_DECODE_H
+#define QUAD_DECODE_H
+
+#include <stdint.h>
+
+/*
+ * decoder state, kept separate from the pins so it can be fed from anywhere
+ * (and tested on a host, see tools/encoder_test.c). ab is (A << 1) | B
+ */
+struct quad_decoder {
+        unsigned char ab;               // last pin state
+        int8_t sub;                     // quarter steps towards the next detent
+        uint32_t last_detent;           // timestamp of the last detent
+        int32_t position;               // detents, accelerated
+        int32_t steps;                  // raw quarter steps, never accelerated
+        uint16_t errors;                // both pins changed at once, a step was missed
+        // acceleration: detents closer together than these count 4x / 2x
+        uint16_t fast_ticks;
+        uint16_t medium_ticks;
+};
+
+#define QUAD_STEPS_PER_DETENT 4
+
+void quad_init(struct quad_decoder *d, unsigned char ab, uint16_t fast_ticks,
+                uint16_t medium_ticks);
+int8_t quad_update(struct quad_decoder *d, unsigned char ab, uint32_t timestamp);
+
+#endif
@@ -9,7 +9,10 @@
 
 // drivers
 #include "ChangeClk.h"
+#include "CN.h"
 #include "timer.h"
+#include "ir_decode.h"
+#include "spsc_queue.h"
 #include "UART2.h" // for testing / debugging only
 
 // values for messages
@@ -19,141 +22,205 @@
 #define VOLUME_UP 0xe0e0e01f
 #define VOLUME_DOWN 0xe0e0d02f
 
+#define MAX_PULSES 68         // a 32 bit pulse distance frame is 66 pulses + stop mark
+#define CAPTURE_SLOTS 2       // power of two, one filling while the main loop decodes one
+#define MS_TO_TICKS(ms) ((uint32_t)(ms) * (TIMESTAMP_TICK_HZ / MS_PER_S))
+
 // constants
-#define LOW_MULT 0.8               //lower limit multiplicator (define used to provide const_expr)
-#define HIGH_MULT 1.2              //upper limit multiplicator (define used to provide const_expr)
-static const char kSetPinToInput = 1;
 static const char kEnable = 1;
 static const char kDisable = 0;
-static const float kMagicNumber = 1.0/2.0; // for the timers, processor specific :p
-static const int kPinValues = 0;
-static const int kElapsedTimes = 1;
-
-//constants to calculate limits
-static const int startHigh1 = 4500.0 * LOW_MULT;
-static const int startHigh2 = 4500.0 * HIGH_MULT;
-static const int bitLow1 = 560.0 * LOW_MULT;
-static const int bitLow2 = 560.0 * HIGH_MULT;
-static const int bitHigh1 = 1600.0 * LOW_MULT;
-static const int bitHigh2 = 1600.0 * HIGH_MULT;
-
-// statics
-static volatile unsigned int signal_raw[70][2]; // can probably set to 68
-static volatile unsigned int raw_i = 0;
-static volatile char isStarted = 0;       //started interpretation of the signal
-
-
-// ****************************************************************** prototypes
-static void print_result(void);
-
-
-// ******************************************************************** CN inits
-static void init_CN0(void) {
-        // note: pin 10 == RA4 == CN0
-        TRISAbits.TRISA4 = kSetPinToInput; // configure IO pin 10/CN0 to be input
-        // CNPU1bits.CN1PUE = kPullUpMode; // set pin to be 'pull up' (ie, connected to ground)
-        CNPD1bits.CN1PDE = kEnable; // set pin to be 'pull down' (ie, connected to ground)
-        CNEN1bits.CN0IE = kEnable; // enable CN1 interrupts
-}
+static const struct ir_timing kTiming = IR_TIMING_TABLE(TIMESTAMP_TICK_HZ); // windows in ticks
+IR_TIMING_CHECK(TIMESTAMP_TICK_HZ);
+static const uint16_t kGapTicks = MS_TO_TICKS(12); // longer than any mark/space (nec header 9ms)
+static const uint32_t kRepeatTicks = MS_TO_TICKS(150); // samsung/nec resend every ~108ms
+static const unsigned char kCyclesPerTick = 8; // fcy / TIMESTAMP_TICK_HZ
+static const uint16_t kMinPulseTicks = 75; // 150us, shortest real pulse is rc6's 444us - 20%
+static const uint8_t kMinPulses = 3; // anything shorter is noise, not worth decoding
+static const unsigned char kMinConfidence = 10; // frames this close to the window edges are dropped
 
-void CN_init(void) {
-        init_CN0();
+// a frame as captured, decoded later by the main loop
+struct ir_capture {
+        uint16_t pulses[MAX_PULSES];
+        uint8_t count;
+        unsigned char overrun;
+        uint32_t start;
+        uint32_t end;
+};
 
-        IFS1bits.CNIF = 0; // clear interrupt flag if it isn't already
-        IPC4bits.CNIP = 3; // set CN interrupt to priority 3
-        IEC1bits.CNIE = kEnable; // enable CN interrupts in general
-}
+SPSC_QUEUE(ir_capture, struct ir_capture, CAPTURE_SLOTS)
 
+// the isrs fill slots in place, the main loop decodes them in place
+static struct ir_capture_queue captures;
+static struct ir_capture *volatile capture = 0; // slot being filled, 0 = skipping the frame
+static volatile unsigned char in_frame = 0;
+static volatile uint16_t last_edge = 0;
 
+// timing of the remote in use, windows follow it
+static struct ir_tracker tracker;
+
+// held button tracking
+static struct ir_frame last_frame;
+static uint32_t last_frame_end = 0;
+static volatile uint16_t repeat_total = 0;
+
+static volatile struct ir_rx_stats stats;
+static uint32_t decode_cycles_max[kIrProtocolCount];
 
-// ******************************************************************** timer up
-void timer_up(void) {
-        // print 2 blank lines
-        XmitUART2('\r', 1);
-        XmitUART2('\n', 1);
-        XmitUART2('\r', 1);
-        XmitUART2('\n', 1);
-        raw_i = 0;
-        print_result();
-}
 
-void timer3_callback(void) {
-        T2CONbits.TON = kDisable; // note: to stop the combined timer, use t2con
-        IEC0bits.T3IE = kDisable; // stop the timer 2/3 combined interrupt
-        TMR2 = TMR3 = 0;
 
-        timer_up();
+// ************************************************************** process signal
+static int same_key(const struct ir_frame *a, const struct ir_frame *b) {
+        return a->protocol == b->protocol && a->address == b->address
+                        && a->command == b->command;
 }
 
+// decodes a captured frame. returns 1 with a new key press in command, 0 if
+// the frame was bad or folded into the held key
+static int process_frame(const struct ir_capture *captured, struct ir_command *command) {
+        struct ir_frame frame;
 
+        uint32_t t0 = get_timestamp_t3();
+        int decoded = ir_decode(captured->pulses, captured->count, &tracker.timing, &frame);
+        uint32_t cost = (get_timestamp_t3() - t0) * kCyclesPerTick;
+        ir_tracker_update(&tracker, &kTiming, &frame, decoded);
 
-// ************************************************************** process signal
-//converts recorded times in raw data to microseconds
-static void convert_times_to_us(void) {
-        int j;
-        for (j = 0; j < 90; j++) {
-                signal_raw[j][kElapsedTimes] = signal_raw[j][kElapsedTimes]
-                                * (1.0 / kMagicNumber) * (1.0 / 8.0); // 1/8 is us_per_s/freq
+        // decode cost per protocol, in instruction cycles
+        if (cost > decode_cycles_max[frame.protocol]) {
+                decode_cycles_max[frame.protocol] = cost;
         }
-}
 
-//Using numbers calculated above for limits of highs and lows
-static int interpret_high_low_pattern(int low_duration, int high_duration, int iters) {
-        //calculates the amount of digital signals passed, to destinguish between
-        //header and the message
-        if (iters > 67) {
-                isStarted = 0;
+        stats.frames++;
+        if (!decoded) {
+                stats.decode_errors++;
+                return 0;
         }
+        if (frame.confidence < kMinConfidence) {
+                stats.low_confidence++; // decoded, but too marginal to trust
+                return 0;
+        }
+
+        // protocols without a repeat code just resend the same frame
+        if (!frame.repeat && same_key(&frame, &last_frame)
+                        && captured->start - last_frame_end < kRepeatTicks) {
+                frame.repeat = 1;
+        }
+        last_frame_end = captured->end;
+
+        if (frame.repeat && same_key(&frame, &last_frame)) {
+                repeat_total++; // collapsed, the main loop sees one press
+                return 0;
+        }
+
+        frame.repeat = 0;
+        last_frame = frame;
+        command->timestamp = captured->start;
+        command->frame = frame;
+        return 1;
+}
 
-        //checks the start bit
-        if (isStarted == 0) {
-                if ((low_duration > startHigh1) && (high_duration < startHigh2)) {
-                        isStarted = 1;
-                        return 2; //arbitrary chosen number
+// gap timer fired: no edge for kGapTicks, so the frame is complete
+static void frame_end_callback(void) {
+        IEC1bits.CNIE = kDisable; // hand the slot over without an edge sneaking in
+        if (capture) {
+                capture->end = get_timestamp_t3();
+                if (capture->overrun) {
+                        stats.overruns++;
+                }
+                if (capture->count < kMinPulses) {
+                        stats.noise_frames++; // slot is simply reused
                 } else {
-                        isStarted = 0;
-                        return -1;
+                        ir_capture_commit(&captures);
                 }
+        } else if (in_frame) {
+                stats.dropped++; // every slot was still waiting for the main loop
         }
+        capture = 0;
+        in_frame = 0;
+        IEC1bits.CNIE = kEnable;
+}
 
-        //checks 1s and 0s of the message
-        if ((low_duration > bitLow1) && (low_duration < bitLow2)) {
-                if ((high_duration > bitLow1) && (high_duration < bitLow2)) {
-                        return 0x0;         //somehow works better this way
+static void ir_cn_handler(unsigned char level, uint16_t now) {
+        uint16_t edge = now;
+
+        if (!in_frame) {
+                if (level != 0) {
+                        return; // frames start with a mark (receiver pulls low)
+                }
+                in_frame = 1;
+                capture = ir_capture_claim(&captures);
+                if (capture) {
+                        capture->count = 0;
+                        capture->overrun = 0;
+                        capture->start = get_timestamp_t3();
                 }
-                if ((high_duration > bitHigh1) && (high_duration < bitHigh2)) {
-                        return 0x1;         //somehow works better this way
+        } else if (capture) { // without a free slot, just wait for the gap
+                edge = last_edge;
+                switch (ir_filter_edge(capture->pulses, &capture->count, MAX_PULSES, &edge,
+                                now, kMinPulseTicks)) {
+                case kIrEdgeGlitchFirst:
+                        stats.glitches++;
+                        in_frame = 0; // the 'first edge' was the glitch
+                        capture = 0;
+                        return;
+                case kIrEdgeGlitch:
+                        stats.glitches++;
+                        break;
+                case kIrEdgeOverrun:
+                        capture->overrun = 1;
+                        break;
+                default:
+                        break;
                 }
-        } else {
-                return -1;
         }
 
-        return -1;
+        last_edge = edge;
+        arm_oneshot_t2(kGapTicks, frame_end_callback);
 }
 
-//receives converted 1s and zero and records them into the output message
-static void interpret_signal(void) {
-        int i;
-        unsigned long int output = 0x0;
-        unsigned int token = 0x0;   //paresed data from 1s and 0s
-        int startedConv = 0;
-
-        //for every two values (1 high and 1 low) convert to digital logic
-        //record into output by XOR and bit shift left
-        for (i = 1; i < 67; i= i + 2) {      //first one is unnecessary
-                token = interpret_high_low_pattern(signal_raw[i][kElapsedTimes], signal_raw[i+1][kElapsedTimes], i);
-                if (token == 2) {
-                    startedConv = 1;
-                }
-                if (startedConv && token != 2) {
-                    output = output ^ token;
-                    if (i < 65)
-                        output = output << 1;
+
+
+// *************************************************************** API functions
+// registers the receiver with the CN driver, call CN_init first
+void ir_rx_init(void) {
+        ir_tracker_init(&tracker, &kTiming);
+        // note: pin 10 == RA4 == CN0, the receiver drives it so no pull up
+        cn_register(0, kCnPortA, 1 << 4, kCnPullDown, ir_cn_handler);
+}
+
+// decodes the captured frames in order until one is a new key press
+int ir_rx_get_command(struct ir_command *command) {
+        struct ir_capture *captured;
+
+        while ((captured = ir_capture_front(&captures))) {
+                int ready = process_frame(captured, command);
+                ir_capture_release(&captures); // the isr may refill it now
+                if (ready) {
+                        return 1;
                 }
         }
+        return 0;
+}
+
+uint16_t ir_rx_repeat_count(void) {
+        return repeat_total;
+}
+
+void ir_rx_get_stats(struct ir_rx_stats *out) {
+        out->frames = stats.frames;
+        out->decode_errors = stats.decode_errors;
+        out->dropped = stats.dropped;
+        out->overruns = stats.overruns;
+        out->glitches = stats.glitches;
+        out->noise_frames = stats.noise_frames;
+        out->low_confidence = stats.low_confidence;
+        out->slots_high_water = captures.high_water;
+}
+
+uint32_t ir_rx_decode_cycles_max(enum IR_PROTOCOL protocol) {
+        return decode_cycles_max[protocol];
+}
 
-        //outputs the HEX value and the appropriate message
-        Disp2Hex32(output);
+static void print_samsung_message(uint32_t output) {
         switch (output){
         case POWER_SWITCH:
                 Disp2String("Power Switched");
@@ -171,51 +238,26 @@ static void interpret_signal(void) {
                 Disp2String("Channel Up");
                 break;
         default:
-                Disp2String("Wrong Message");
+                Disp2String("Unknown Samsung Key");
                 break;
         }
 }
 
-//calls the function to print the result
-static void print_result(void) {
-        // int i;
-        convert_times_to_us();
-
-        //sends hex values
-        // for (i = 0; i < 90; i++) {
-        //         Disp2Hex32(signal_raw[i][kPinValues]); // signal values at interrupt time
-        //         Disp2Hex32(signal_raw[i][kElapsedTimes]); // elapsed times before interrupt
-        //         XmitUART2('\r', 1);
-        //         XmitUART2('\n', 1);
-        // }
-        interpret_signal();
-}
-
-static void handle_CN_interrupt(uint32_t tmr2_snapshot) {
-
-        static volatile uint32_t prev_tmr;
-
-        if (raw_i == 0) {
-                // note: 500kHz clock was too slow detect many of the transitions
-                delay_us_32bit(140000, timer3_callback); // todo: give it watchdog functionality
-                prev_tmr = 0;
-        }
-
-        if ( raw_i < 67) {
-                signal_raw[raw_i][kPinValues] = PORTAbits.RA4==0; // have we switched to high?
-                // take the difference so that we don't need to stop our pseudo watchdog
-                signal_raw[raw_i][kElapsedTimes] = tmr2_snapshot - prev_tmr;
-                prev_tmr = tmr2_snapshot;
-        } else {
-
+// prints the normalized record. only call from the main loop
+void ir_rx_print_command(const struct ir_command *command) {
+        XmitUART2('\r', 1);
+        XmitUART2('\n', 1);
+        Disp2Hex32(command->timestamp);
+        Disp2String((char *)ir_protocol_name(command->frame.protocol));
+        Disp2Hex(command->frame.address);
+        Disp2Hex(command->frame.command);
+        Disp2String("confidence:");
+        Disp2Hex(command->frame.confidence);
+        Disp2String("deviation %:");
+        Disp2Hex(command->frame.deviation_pct);
+        if (command->frame.protocol == kIrSamsung) {
+                print_samsung_message(command->frame.raw);
         }
-
-        raw_i++;
-}
-
-// *********************************************************** interrupt handler
-// in this version, we try to use CN interrupts to read the signal
-void __attribute__((interrupt, no_auto_psv)) _CNInterrupt(void) {
-        IFS1bits.CNIF = 0; // clear interrupt flag
-        handle_CN_interrupt(TMR2);
+        Disp2String(" max cycles:");
+        Disp2Hex32(decode_cycles_max[command->frame.protocol]);
 }
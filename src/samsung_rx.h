@@ -1,7 +1,33 @@
 #ifndef SAMSUNG_RX_H
 #define SAMSUNG_RX_H
 
-void CN_init(void);
-void timer_up(void);
+#include <stdint.h>
+#include "ir_decode.h"
+
+// a decoded key press, timestamp is when its first edge arrived (TIMESTAMP_TICK_HZ)
+struct ir_command {
+        uint32_t timestamp;
+        struct ir_frame frame;
+};
+
+struct ir_rx_stats {
+        uint16_t frames;        // frames that ended (gap seen)
+        uint16_t decode_errors; // frames no decoder accepted
+        uint16_t dropped;       // frames lost, every capture slot waited for the main loop
+        uint16_t overruns;      // frames longer than the capture buffer
+        uint16_t glitches;      // edges dropped by the minimum pulse filter
+        uint16_t noise_frames;  // too short to be a frame, never decoded
+        uint16_t low_confidence; // decoded, but dropped for marginal timing
+        uint8_t slots_high_water; // most frames ever waiting to be decoded
+};
+
+void ir_rx_init(void);
+
+// main loop side
+int ir_rx_get_command(struct ir_command *command); // 1 if a new key press was decoded
+uint16_t ir_rx_repeat_count(void); // running count of collapsed held-button repeats
+void ir_rx_get_stats(struct ir_rx_stats *stats);
+uint32_t ir_rx_decode_cycles_max(enum IR_PROTOCOL protocol);
+void ir_rx_print_command(const struct ir_command *command);
 
 #endif
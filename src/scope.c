@@ -0,0 +1,262 @@
+// scope.c
+
+// libraries & header
+#include "scope.h"
+
+// project files
+#include "ADC.h"
+#include "CN.h"
+#include "comparator.h"
+#include "Timer.h"
+#include "UART2.h"
+
+// Magic Numbers
+static const uint16_t kRingMask = SCOPE_RING - 1;
+
+// statics, main loop unless marked
+static struct scope_config config;
+static volatile enum SCOPE_STATE state = kScopeIdle; // the isr triggers read it
+static volatile unsigned char trigger_pending = 0; // set by the isrs while armed
+static volatile uint32_t trigger_time = 0; // get_timestamp_t3, valid while pending
+static uint16_t ring[SCOPE_RING];
+static uint16_t written = 0; // samples into the ring ever, wraps
+static uint16_t filled = 0; // since the start, a gap or the last dump
+static uint16_t trigger_index = 0; // in written terms
+static uint16_t armed_at = 0;
+static uint16_t period = 0; // timer 3 ticks per sample
+static uint32_t last_block = 0;
+static unsigned char cn_pin = 0xff; // registered once, cn_register has no undo
+static enum CN_PORT cn_port = kCnPortA;
+static struct scope_stats stats;
+
+
+
+// **************************************************************** isr triggers
+static void isr_trigger(unsigned char high, uint32_t timestamp) {
+        if (state == kScopeArmed && !trigger_pending && high != config.falling) {
+                trigger_time = timestamp;
+                trigger_pending = 1;
+        }
+}
+
+static void comparator_trigger(unsigned char high, uint32_t timestamp) {
+        isr_trigger(high, timestamp);
+}
+
+// the CN timestamp is the low half, the full one is at most a few ticks on
+static void cn_trigger(unsigned char level, uint16_t timestamp) {
+        uint32_t now = get_timestamp_t3();
+
+        if (config.trigger == kScopeCn) {
+                isr_trigger(level, now - (uint16_t)((uint16_t)now - timestamp));
+        }
+}
+
+
+
+// ************************************************************ helper functions
+static void arm(void) {
+        state = kScopeFilling; // the isrs stop taking triggers first
+        trigger_pending = 0;
+        filled = 0;
+}
+
+// the block timestamp is taken as its last sample comes in, sample i of the
+// block is (ADC_BLOCK - 1 - i) periods before it. 0 if the trigger is later
+static int locate_trigger(const struct adc_block *block, uint16_t *index) {
+        int32_t ago = (int32_t)(block->timestamp - trigger_time);
+        uint32_t samples_ago;
+
+        if (ago < 0) {
+                return 0;
+        }
+        samples_ago = ((uint32_t)ago + period / 2) / period;
+        if (samples_ago > (uint16_t)(written + ADC_BLOCK - 1 - armed_at)) {
+                *index = armed_at; // before arming is isr latency, not the signal
+        } else {
+                *index = written + ADC_BLOCK - 1 - (uint16_t)samples_ago;
+        }
+        return 1;
+}
+
+static unsigned char level_crossed(uint16_t before, uint16_t sample) {
+        if (config.falling) {
+                return before >= config.level && sample < config.level;
+        }
+        return before < config.level && sample >= config.level;
+}
+
+// the ring keeps going until the post samples are in. an isr trigger can be
+// in the block still to come, ahead of written
+static void check_frozen(void) {
+        if (state == kScopeTriggered && (int16_t)(written - trigger_index) > config.post) {
+                stats.captures++;
+                state = kScopeFrozen;
+        }
+}
+
+static void put_sample(uint16_t sample) {
+        uint16_t before = ring[(written - 1) & kRingMask];
+
+        ring[written & kRingMask] = sample;
+        written++;
+        filled++;
+
+        switch (state) {
+        case kScopeFilling:
+                if (filled > config.pre) {
+                        armed_at = written;
+                        state = kScopeArmed;
+                }
+                break;
+        case kScopeArmed:
+                if (config.trigger == kScopeLevel && level_crossed(before, sample)) {
+                        trigger_index = written - 1;
+                        state = kScopeTriggered;
+                }
+                break;
+        default:
+                break;
+        }
+        check_frozen();
+}
+
+static void take_block(const struct adc_block *block) {
+        uint16_t index;
+        uint16_t end;
+        unsigned char i;
+
+        // a lost block breaks the timeline, start over
+        if (filled && block->timestamp - last_block > (uint32_t)period * ADC_BLOCK * 3 / 2) {
+                stats.gaps++;
+                arm();
+        }
+        last_block = block->timestamp;
+
+        if (state == kScopeArmed && trigger_pending && locate_trigger(block, &index)) {
+                trigger_pending = 0;
+                end = index + config.post + 1;
+                if ((int16_t)(written - end) > 0) {
+                        end = written; // the post samples are in already
+                }
+                if ((uint16_t)(end - (index - config.pre)) > SCOPE_RING) {
+                        stats.missed++; // the main loop sat on it too long
+                } else {
+                        trigger_index = index;
+                        state = kScopeTriggered;
+                        check_frozen();
+                }
+        }
+        for (i = 0; i < ADC_BLOCK && state != kScopeFrozen; i++) {
+                put_sample(block->samples[i]);
+        }
+}
+
+static void dump_signed(char *sign, uint16_t value) {
+        Disp2String(sign);
+        Disp2Dec(value);
+}
+
+
+
+// *************************************************************** API functions
+int scope_start(const struct scope_config *new_config) {
+        struct adc_acq_config acq = {new_config->channel, 31, 7, new_config->rate_hz};
+        struct adc_block block;
+        uint32_t ticks;
+
+        if (!new_config->rate_hz || new_config->rate_hz > ADC_MAX_RATE_HZ
+                        || new_config->pre + new_config->post + 1 > SCOPE_RING) {
+                return 0;
+        }
+        if (new_config->trigger == kScopeCn) {
+                if (cn_pin == 0xff) {
+                        if (!cn_register(new_config->cn, new_config->port, new_config->mask,
+                                        kCnPullNone, cn_trigger)) {
+                                return 0;
+                        }
+                        cn_pin = new_config->cn;
+                        cn_port = new_config->port;
+                } else if (cn_pin != new_config->cn || cn_port != new_config->port) {
+                        return 0;
+                }
+        }
+
+        scope_stop();
+        config = *new_config;
+        while (adc_get_block(&block)) {} // left over from an earlier run
+        if (!adc_acq_start(&acq)) {
+                return 0;
+        }
+        ticks = (TIMESTAMP_TICK_HZ + config.rate_hz / 2) / config.rate_hz;
+        period = ticks > 0xffff ? 0xffff : ticks; // as ADC.c
+        stats.captures = 0;
+        stats.gaps = 0;
+        stats.missed = 0;
+        arm();
+        if (config.trigger == kScopeComparator) {
+                cmp_set_crossing_handler(comparator_trigger);
+        }
+        return 1;
+}
+
+void scope_poll(void) {
+        struct adc_block block;
+
+        if (state == kScopeIdle) {
+                return;
+        }
+        while (state != kScopeFrozen && adc_get_block(&block)) {
+                take_block(&block);
+        }
+}
+
+enum SCOPE_STATE scope_state(void) {
+        return state;
+}
+
+// the adc keeps going, what it queues meanwhile is thrown away when arming
+void scope_dump(void) {
+        static char *const kSources[] = {"level", "comparator", "cn"};
+        struct adc_block block;
+        uint16_t i;
+
+        if (state != kScopeFrozen) {
+                return;
+        }
+        Disp2String("\n\rscope");
+        Disp2Dec(config.rate_hz);
+        Disp2String("Hz");
+        Disp2Dec(config.pre);
+        Disp2String("pre");
+        Disp2Dec(config.post);
+        Disp2String("post, trigger ");
+        Disp2String(kSources[config.trigger]);
+        for (i = config.pre; i > 0; i--) {
+                dump_signed("\n\r-", i);
+                Disp2Dec(ring[(trigger_index - i) & kRingMask]);
+        }
+        for (i = 0; i <= config.post; i++) {
+                dump_signed("\n\r+", i);
+                Disp2Dec(ring[(trigger_index + i) & kRingMask]);
+        }
+
+        while (adc_get_block(&block)) {}
+        arm();
+}
+
+void scope_stop(void) {
+        if (state == kScopeIdle) {
+                return;
+        }
+        if (config.trigger == kScopeComparator) {
+                cmp_set_crossing_handler(0);
+        }
+        state = kScopeIdle; // the CN handler stays, idle keeps it quiet
+        trigger_pending = 0;
+        adc_acq_stop();
+}
+
+void scope_get_stats(struct scope_stats *out) {
+        *out = stats;
+}
@@ -0,0 +1,61 @@
+// scope.h
+#ifndef SCOPE_H
+#define SCOPE_H
+
+#include <stdint.h>
+
+#include "CN.h"
+
+/*
+ * triggered capture. the adc runs at a fixed rate the whole time and the main
+ * loop keeps the newest samples in a ring; once pre samples are in, a trigger
+ * is taken. the comparator and CN triggers come from their isrs with a
+ * timestamp, which the block timestamps turn back into a sample, so the
+ * trigger point is right to a sample whatever the main loop was doing. post
+ * samples later the ring freezes until scope_dump has sent it out as text:
+ *   scope <rate> Hz <pre> pre <post> post, trigger <source>
+ *   then one line per sample, its offset from the trigger and its value
+ */
+#define SCOPE_RING 64 // samples, power of two. pre + post + 1 must fit
+
+enum SCOPE_TRIGGER {
+        kScopeLevel = 0,        // the samples crossing level
+        kScopeComparator,       // a comparator crossing, see comparator.h
+        kScopeCn                // a CN edge on the pin below
+};
+
+enum SCOPE_STATE {
+        kScopeIdle = 0,
+        kScopeFilling,          // not yet pre samples since the start or a gap
+        kScopeArmed,
+        kScopeTriggered,        // waiting for the post samples
+        kScopeFrozen            // ready for scope_dump
+};
+
+struct scope_config {
+        unsigned char channel;
+        uint16_t rate_hz;               // timer 3 triggered, up to ADC_MAX_RATE_HZ
+        enum SCOPE_TRIGGER trigger;
+        unsigned char falling;          // edge for all sources, 0 rising
+        uint16_t level;                 // adc code, kScopeLevel only
+        unsigned char cn;               // kScopeCn only, as for cn_register
+        enum CN_PORT port;
+        uint16_t mask;
+        uint8_t pre;
+        uint8_t post;
+};
+
+struct scope_stats {
+        uint16_t captures;
+        uint16_t gaps;          // main loop too late, the adc queue lost blocks
+        uint16_t missed;        // isr triggers already out of the ring when seen
+};
+
+int scope_start(const struct scope_config *config); // 0 if invalid or the adc is taken
+void scope_poll(void); // main loop, never blocks
+enum SCOPE_STATE scope_state(void);
+void scope_dump(void); // blocking, sends a frozen capture and arms again
+void scope_stop(void);
+void scope_get_stats(struct scope_stats *stats);
+
+#endif
@@ -0,0 +1,96 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <stdint.h>
+
+/*
+ * single producer (an isr) / single consumer (the main loop) ring, sized at
+ * compile time per use:
+ *   SPSC_QUEUE(ir_capture, struct ir_capture, 2)
+ *   static struct ir_capture_queue captures;
+ * declares struct ir_capture_queue and static inline ir_capture_push(),
+ * _pop(), _claim() / _commit(), _front() / _release() and _count().
+ *
+ * size is a power of two, at most 128. head and tail run freely and only their
+ * difference is used, so every slot is usable. head is only written by the
+ * producer and tail only by the consumer, byte writes are atomic, so neither
+ * side disables interrupts or waits: a push or pop is a fixed handful of
+ * instructions plus the copy of one item.
+ *
+ * _claim() / _commit() and _front() / _release() work in place, for items too
+ * big to copy around (a claimed slot is not visible to the consumer until it
+ * is committed, a front slot is not reused until it is released)
+ */
+
+// keeps the compiler from moving item accesses past the index update
+#define SPSC_BARRIER() __asm__ volatile ("" ::: "memory")
+
+#define SPSC_QUEUE(name, type, size)                                            \
+typedef char name##_size_is_a_power_of_two                                      \
+                [((size) & ((size) - 1)) == 0 && (size) <= 128 ? 1 : -1];       \
+                                                                                \
+struct name##_queue {                                                           \
+        type items[size];                                                       \
+        volatile uint8_t head;          /* producer side */                     \
+        volatile uint8_t tail;          /* consumer side */                     \
+        volatile uint8_t high_water;    /* most items ever queued at once */    \
+        volatile uint16_t dropped;      /* pushes that found the queue full */  \
+};                                                                              \
+                                                                                \
+static inline uint8_t name##_count(const struct name##_queue *q) {             \
+        return (uint8_t)(q->head - q->tail);                                    \
+}                                                                               \
+                                                                                \
+/* producer: next free slot, 0 if full. does not count as a drop */            \
+static inline type *name##_claim(struct name##_queue *q) {                     \
+        if ((uint8_t)(q->head - q->tail) >= (size)) {                           \
+                return 0;                                                       \
+        }                                                                       \
+        return &q->items[q->head & ((size) - 1)];                               \
+}                                                                               \
+                                                                                \
+static inline void name##_commit(struct name##_queue *q) {                     \
+        uint8_t used = (uint8_t)(q->head - q->tail) + 1;                        \
+        if (used > q->high_water) {                                             \
+                q->high_water = used;                                           \
+        }                                                                       \
+        SPSC_BARRIER();                                                         \
+        q->head++;                                                              \
+}                                                                               \
+                                                                                \
+static inline int name##_push(struct name##_queue *q, const type *item) {      \
+        type *slot = name##_claim(q);                                           \
+        if (!slot) {                                                            \
+                q->dropped++;                                                   \
+                return 0;                                                       \
+        }                                                                       \
+        *slot = *item;                                                          \
+        name##_commit(q);                                                       \
+        return 1;                                                               \
+}                                                                               \
+                                                                                \
+/* consumer: oldest item, 0 if empty */                                         \
+static inline type *name##_front(struct name##_queue *q) {                     \
+        if (q->head == q->tail) {                                               \
+                return 0;                                                       \
+        }                                                                       \
+        SPSC_BARRIER();                                                         \
+        return &q->items[q->tail & ((size) - 1)];                               \
+}                                                                               \
+                                                                                \
+static inline void name##_release(struct name##_queue *q) {                    \
+        SPSC_BARRIER();                                                         \
+        q->tail++;                                                              \
+}                                                                               \
+                                                                                \
+static inline int name##_pop(struct name##_queue *q, type *item) {             \
+        type *slot = name##_front(q);                                           \
+        if (!slot) {                                                            \
+                return 0;                                                       \
+        }                                                                       \
+        *item = *slot;                                                          \
+        name##_release(q);                                                      \
+        return 1;                                                               \
+}
+
+#endif
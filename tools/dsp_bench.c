@@ -0,0 +1,279 @@
+/*
+ * File:   dsp_bench.c
+ *
+ * Host-side check and benchmark for the integer filters in src/dsp_filter.c.
+ * Feeds a 14 bit test signal (steps, noise and spikes, like an oversampled
+ * adc channel) through every filter and compares each output with a brute
+ * force reference computed the slow way, then times every filter per sample.
+ *
+ * build & run (from the repo root):
+ *      gcc -O2 -Wall -Isrc -o dsp_bench tools/dsp_bench.c src/dsp_filter.c
+ *      ./dsp_bench
+ *
+ * options:
+ *      --samples N     length of the test signal (default 20000)
+ *      --seed N        seed for the noise generator (default 1)
+ *
+ * the timings are host cycles (the time stamp counter on x86, nanoseconds
+ * elsewhere), only good for comparing the filters with each other. the exit
+ * status is 0 only if every filter matched its reference
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "dsp_filter.h"
+
+#define MAX_SAMPLES 100000
+#define BENCH_REPEATS 20        // the fastest run counts
+#define STEP_SAMPLES 500
+#define SPIKE_ONE_IN 200
+
+static uint16_t signal[MAX_SAMPLES];
+static uint64_t stage[DSP_CIC_MAX_ORDER + 1][MAX_SAMPLES];
+static int samples = 20000;
+
+
+
+// ************************************************************ helper functions
+// steps between 3000 and 12000, 9 bits of noise, a spike of 4000 now and then
+static void make_signal(void) {
+        int i;
+
+        for (i = 0; i < samples; i++) {
+                signal[i] = (uint16_t)((i / STEP_SAMPLES) % 2 ? 12000 : 3000) + rand() % 512
+                                + (rand() % SPIKE_ONE_IN == 0 ? 4000 : 0);
+        }
+}
+
+static int compare_samples(const void *a, const void *b) {
+        return *(const uint16_t *)a - *(const uint16_t *)b;
+}
+
+static uint64_t ticks_now(void) {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+#endif
+}
+
+
+
+// ************************************************************** the references
+// the plain sum of the last 2^bits inputs, zeros before the first, rounded
+static int check_moving_average(void) {
+        int mismatches = 0;
+        uint8_t bits;
+        int i;
+        int k;
+
+        for (bits = 0; bits <= DSP_MA_MAX_BITS; bits++) {
+                struct dsp_ma f;
+                int length = 1 << bits;
+
+                dsp_ma_init(&f, bits);
+                for (i = 0; i < samples; i++) {
+                        uint32_t sum = 0;
+                        for (k = 0; k < length && i - k >= 0; k++) {
+                                sum += signal[i - k];
+                        }
+                        uint16_t want = (sum + length / 2) >> bits;
+                        mismatches += dsp_ma_update(&f, signal[i]) != want;
+                }
+        }
+        printf("moving average 1-%d:  %d mismatches\n", 1 << DSP_MA_MAX_BITS, mismatches);
+        return mismatches;
+}
+
+// the middle of the sorted window, shorter while it fills
+static int check_median(void) {
+        uint16_t window[DSP_MEDIAN_MAX];
+        int mismatches = 0;
+        uint8_t length;
+        int i;
+        int k;
+
+        for (length = 1; length <= DSP_MEDIAN_MAX; length += 2) {
+                struct dsp_median f;
+
+                dsp_median_init(&f, length);
+                for (i = 0; i < samples; i++) {
+                        int count = 0;
+                        for (k = 0; k < length && i - k >= 0; k++) {
+                                window[count++] = signal[i - k];
+                        }
+                        qsort(window, count, sizeof(window[0]), compare_samples);
+                        mismatches += dsp_median_update(&f, signal[i]) != window[count / 2];
+                }
+        }
+        printf("median 1-%d:           %d mismatches\n", DSP_MEDIAN_MAX, mismatches);
+        return mismatches;
+}
+
+// a cic of order n is n boxcars of length R in series, every Rth output kept
+static int check_cic(void) {
+        int mismatches = 0;
+        uint8_t order;
+        uint8_t rate_bits;
+        int i;
+        int k;
+        int s;
+
+        for (order = 1; order <= DSP_CIC_MAX_ORDER; order++) {
+                for (rate_bits = 1; rate_bits <= 6; rate_bits++) {
+                        struct dsp_cic f;
+                        int rate = 1 << rate_bits;
+
+                        for (i = 0; i < samples; i++) {
+                                stage[0][i] = signal[i];
+                        }
+                        for (s = 1; s <= order; s++) {
+                                for (i = 0; i < samples; i++) {
+                                        uint64_t sum = 0;
+                                        for (k = 0; k < rate && i - k >= 0; k++) {
+                                                sum += stage[s - 1][i - k];
+                                        }
+                                        stage[s][i] = sum;
+                                }
+                        }
+
+                        dsp_cic_init(&f, order, rate_bits);
+                        for (i = 0; i < samples; i++) {
+                                uint16_t out;
+                                int last = i % rate == rate - 1;
+                                if (!dsp_cic_update(&f, signal[i], &out)) {
+                                        mismatches += last;
+                                        continue;
+                                }
+                                mismatches += !last
+                                                || out != (uint16_t)(stage[order][i] >> (order * rate_bits));
+                        }
+                }
+        }
+        printf("cic order 1-%d, 2-64:  %d mismatches\n", DSP_CIC_MAX_ORDER, mismatches);
+        return mismatches;
+}
+
+// no closed form worth having: settles on a full scale step, never overshoots
+static int check_iir(void) {
+        struct dsp_iir f;
+        uint16_t out = 0;
+        int overshoots = 0;
+        int i;
+
+        dsp_iir_init(&f, 4);
+        for (i = 0; i < 300; i++) {
+                out = dsp_iir_update(&f, i < 100 ? 1000 : 16383);
+        }
+        for (i = 0; i < 300; i++) {
+                out = dsp_iir_update(&f, 16383);
+                overshoots += out > 16383;
+        }
+        printf("iir 1/16 step:         settles at %u (want 16383), %d overshoots\n", out,
+                        overshoots);
+        return (out != 16383) + overshoots;
+}
+
+// the generic wrapper, in place: a cic 2/4 over 1..8 gives 2 outputs, the
+// boxcar sums 20 and 80 shifted down by 4
+static int check_block(void) {
+        uint16_t block[8] = {1, 2, 3, 4, 5, 6, 7, 8};
+        struct dsp_filter f;
+
+        dsp_filter_init(&f, kDspCic, (2 << 4) | 2);
+        uint8_t produced = dsp_filter_block(&f, block, 8, block);
+        printf("cic 2/4 block:         %u outputs, %u %u (want 2, 1 5), in place\n", produced,
+                        block[0], block[1]);
+        return produced != 2 || block[0] != 1 || block[1] != 5;
+}
+
+
+
+// *************************************************************** the benchmark
+static void benchmark(void) {
+        static const struct {
+                const char *name;
+                enum DSP_KIND kind;
+                uint8_t param;
+        } kCases[] = {
+                {"moving average 32", kDspMovingAverage, 5},
+                {"iir 1/16", kDspIir, 4},
+                {"median 3", kDspMedian, 3},
+                {"median 7", kDspMedian, 7},
+                {"cic 3 / 16", kDspCic, (3 << 4) | 4},
+                {"cic 1 / 64", kDspCic, (1 << 4) | 6},
+        };
+        unsigned int c;
+
+        printf("\nper sample, fastest of %d runs over %d samples (host)\n", BENCH_REPEATS,
+                        samples);
+        for (c = 0; c < sizeof(kCases) / sizeof(kCases[0]); c++) {
+                struct dsp_filter f;
+                volatile uint32_t sink = 0;
+                uint64_t best = UINT64_MAX;
+                uint16_t out;
+                int repeat;
+                int i;
+
+                dsp_filter_init(&f, kCases[c].kind, kCases[c].param);
+                for (repeat = 0; repeat < BENCH_REPEATS; repeat++) {
+                        uint64_t start = ticks_now();
+                        for (i = 0; i < samples; i++) {
+                                if (dsp_filter_update(&f, signal[i], &out)) {
+                                        sink += out;
+                                }
+                        }
+                        uint64_t elapsed = ticks_now() - start;
+                        if (elapsed < best) {
+                                best = elapsed;
+                        }
+                }
+                printf("  %-18s %6.1f\n", kCases[c].name, (double)best / samples);
+        }
+}
+
+
+
+// ************************************************************************ main
+int main(int argc, char **argv) {
+        unsigned int seed = 1;
+        int failures = 0;
+        int i;
+
+        for (i = 1; i < argc; i++) {
+                if (!strcmp(argv[i], "--samples") && i + 1 < argc) {
+                        samples = atoi(argv[++i]);
+                } else if (!strcmp(argv[i], "--seed") && i + 1 < argc) {
+                        seed = strtoul(argv[++i], NULL, 0);
+                } else {
+                        samples = 0;
+                        break;
+                }
+        }
+
+        if (samples <= 0 || samples > MAX_SAMPLES) {
+                fprintf(stderr, "usage: %s [--samples N (1-%d)] [--seed N]\n", argv[0],
+                                MAX_SAMPLES);
+                return 2;
+        }
+
+        srand(seed);
+        make_signal();
+        failures += check_moving_average();
+        failures += check_median();
+        failures += check_cic();
+        failures += check_iir();
+        failures += check_block();
+        benchmark();
+
+        return failures ? 1 : 0;
+}
@@ -0,0 +1,198 @@
+/*
+ * File:   encoder_test.c
+ *
+ * Host-side test for the quadrature decoder in src/quad_decode.c, the table
+ * the encoder driver runs from its CN handler. Feeds it the pin sequences of
+ * a knob turned forward and backward at several speeds, with contact bounce
+ * on one channel, and with impossible two-bit jumps, and checks the steps,
+ * detents and errors it counts.
+ *
+ * build & run (from the repo root):
+ *      gcc -O2 -Wall -Isrc -o encoder_test tools/encoder_test.c src/quad_decode.c
+ *      ./encoder_test
+ *
+ * options:
+ *      --detents N     detents per turn (default 1000)
+ *      --seed N        seed for the bounce generator (default 1)
+ *
+ * the exit status is 0 only if every case counted what it should
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "quad_decode.h"
+
+#define TEST_TICK_HZ 500000UL   // same as TIMESTAMP_TICK_HZ in Timer.h
+#define FAST_MS 15              // same as kFastTicks in encoder.c
+#define MEDIUM_MS 40            // same as kMediumTicks in encoder.c
+#define BOUNCE_ONE_IN 4
+#define BOUNCE_MAX 5            // make / break pairs per bounce
+
+// ab for each quarter step going forward: A leads B
+static const unsigned char kForward[4] = {0, 2, 3, 1};
+
+static int detents = 1000;
+
+
+
+// ************************************************************ helper functions
+static uint16_t ms_to_ticks(unsigned int ms) {
+        return TEST_TICK_HZ / 1000 * ms;
+}
+
+static int expect(const char *name, long got, long want) {
+        if (got == want) {
+                return 0;
+        }
+        printf("  %s: %ld, want %ld\n", name, got, want);
+        return 1;
+}
+
+
+
+// ****************************************************************** the cases
+// a turn of detents in direction dir (+1 / -1), one edge every edge_ticks,
+// the changing pin bouncing now and then if asked to
+static int turn(uint32_t edge_ticks, int dir, int bounce) {
+        struct quad_decoder d;
+        uint32_t now = 0;
+        int index = 0;
+        int bounces = 0;
+        int failures = 0;
+        int i;
+        int k;
+
+        quad_init(&d, kForward[0], 0, 0); // no acceleration, position follows steps
+        for (i = 0; i < detents * QUAD_STEPS_PER_DETENT; i++) {
+                int previous = index;
+                index = (index + (dir > 0 ? 1 : 3)) & 3;
+                if (bounce && rand() % BOUNCE_ONE_IN == 0) {
+                        // the contact makes and breaks a few times before it settles
+                        for (k = rand() % BOUNCE_MAX + 1; k > 0; k--) {
+                                quad_update(&d, kForward[index], now);
+                                quad_update(&d, kForward[previous], now);
+                                bounces++;
+                        }
+                }
+                quad_update(&d, kForward[index], now);
+                quad_update(&d, kForward[index], now); // the other pin's call, no change
+                now += edge_ticks;
+        }
+
+        printf("%s %5lu ticks/edge%s: steps %ld position %ld errors %u",
+                        dir > 0 ? "forward" : "reverse", (unsigned long)edge_ticks,
+                        bounce ? ", bouncing" : "", (long)d.steps, (long)d.position, d.errors);
+        if (bounce) {
+                printf(" (%d bounces)", bounces);
+        }
+        printf("\n");
+
+        failures += expect("steps", d.steps, (long)dir * detents * QUAD_STEPS_PER_DETENT);
+        failures += expect("position", d.position, (long)dir * detents);
+        failures += expect("errors", d.errors, 0);
+        return failures;
+}
+
+// a detent every 4 edges: 1x slower than MEDIUM_MS apart, 2x below it, 4x below
+// FAST_MS
+static int acceleration(void) {
+        static const struct {
+                unsigned int detent_ms;
+                int gain;
+        } kCases[] = {{100, 1}, {MEDIUM_MS + 1, 1}, {30, 2}, {FAST_MS + 1, 2}, {10, 4}, {1, 4}};
+        int failures = 0;
+        unsigned int c;
+
+        for (c = 0; c < sizeof(kCases) / sizeof(kCases[0]); c++) {
+                uint32_t edge_ticks = ms_to_ticks(kCases[c].detent_ms) / QUAD_STEPS_PER_DETENT;
+                struct quad_decoder d;
+                uint32_t now = ms_to_ticks(1000); // the first detent is slow
+                int i;
+
+                quad_init(&d, kForward[0], ms_to_ticks(FAST_MS), ms_to_ticks(MEDIUM_MS));
+                for (i = 1; i <= 2 * QUAD_STEPS_PER_DETENT; i++) {
+                        quad_update(&d, kForward[i & 3], now);
+                        now += edge_ticks;
+                }
+                printf("detents %3u ms apart: position %ld (want %d)\n", kCases[c].detent_ms,
+                                (long)d.position, 1 + kCases[c].gain);
+                failures += d.position != 1 + kCases[c].gain;
+        }
+        return failures;
+}
+
+// both pins changing at once, from every state: one error each, nothing
+// counted, and the decoder carries on from the new state
+static int invalid_jumps(void) {
+        int failures = 0;
+        int index;
+
+        for (index = 0; index < 4; index++) {
+                struct quad_decoder d;
+                unsigned char from = kForward[index];
+                unsigned char to = from ^ 3;
+                int8_t detent = 0;
+                int i;
+
+                quad_init(&d, from, 0, 0);
+                detent += quad_update(&d, to, 0);
+                failures += expect("steps after the jump", d.steps, 0);
+                failures += expect("errors after the jump", d.errors, 1);
+
+                // then a clean forward detent from where the pins ended up
+                for (i = 1; i <= QUAD_STEPS_PER_DETENT; i++) {
+                        detent += quad_update(&d, kForward[(index + 2 + i) & 3], 0);
+                }
+                printf("jump %u%u -> %u%u: errors %u, then steps %ld position %ld\n", from >> 1,
+                                from & 1, to >> 1, to & 1, d.errors, (long)d.steps,
+                                (long)d.position);
+                failures += expect("steps", d.steps, QUAD_STEPS_PER_DETENT);
+                failures += expect("position", d.position, 1);
+                failures += expect("returned", detent, 1);
+                failures += expect("errors", d.errors, 1);
+        }
+        return failures;
+}
+
+
+
+// ************************************************************************ main
+int main(int argc, char **argv) {
+        static const uint32_t kEdgeTicks[] = {5000, 500, 100, 50, 25}; // 100Hz to 20kHz
+        unsigned int seed = 1;
+        int failures = 0;
+        unsigned int r;
+        int i;
+
+        for (i = 1; i < argc; i++) {
+                if (!strcmp(argv[i], "--detents") && i + 1 < argc) {
+                        detents = atoi(argv[++i]);
+                } else if (!strcmp(argv[i], "--seed") && i + 1 < argc) {
+                        seed = strtoul(argv[++i], NULL, 0);
+                } else {
+                        detents = 0;
+                        break;
+                }
+        }
+
+        if (detents <= 0 || detents > 100000) {
+                fprintf(stderr, "usage: %s [--detents N (1-100000)] [--seed N]\n", argv[0]);
+                return 2;
+        }
+
+        srand(seed);
+        for (r = 0; r < sizeof(kEdgeTicks) / sizeof(kEdgeTicks[0]); r++) {
+                failures += turn(kEdgeTicks[r], 1, 0);
+                failures += turn(kEdgeTicks[r], -1, 0);
+        }
+        failures += turn(100, 1, 1);
+        failures += turn(100, -1, 1);
+        failures += acceleration();
+        failures += invalid_jumps();
+
+        printf(failures ? "FAIL\n" : "PASS\n");
+        return failures ? 1 : 0;
+}
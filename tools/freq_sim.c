@@ -0,0 +1,150 @@
+/*
+ * File:   freq_sim.c
+ *
+ * Host-side accuracy check for the frequency meter counting in
+ * src/freq_count.c. An ideal edge source stands in for the comparator: every
+ * rising edge is timestamped on a simulated 500kHz timer 3 and counted the way
+ * the comparator isr does, and the gate one shot fires exactly when the
+ * counter asked it to. Each frequency is measured in gated, reciprocal and
+ * auto mode on a 100ms and a 1s gate and checked against the resolution of
+ * the mode.
+ *
+ * build & run (from the repo root):
+ *      gcc -O2 -Wall -Isrc -o freq_sim tools/freq_sim.c src/freq_count.c -lm
+ *      ./freq_sim
+ *
+ * options:
+ *      --jitter PCT    random period jitter of the source, +-PCT% (default 0)
+ *      --seed N        seed for the jitter generator (default 1)
+ *
+ * bounds: gated is off by at most 1 edge per gate (unchecked below 2 edges a
+ * gate), reciprocal by 1 tick at each end of its periods, auto by whichever
+ * of the two it used. with jitter the bounds only hold on average, so they
+ * are printed but not checked. the exit status is 0 only if every
+ * measurement was within its bound
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "freq_count.h"
+
+#define SIM_TICK_HZ 500000UL    // same as TIMESTAMP_TICK_HZ in Timer.h
+#define SIM_LIMIT_S 60.0        // give up on a frequency after this long
+#define READINGS 3              // averaged, after the first one is dropped
+#define DECIMALS 3
+
+static const double kFrequencies[] = {0.5, 1, 3.3, 10, 60, 440, 1000, 4321.5, 20000, 50000};
+static const uint16_t kGates[] = {100, 1000};
+static const char *const kModeNames[] = {"gated", "reciprocal", "auto"};
+
+static double jitter = 0;
+
+
+
+// ************************************************************ helper functions
+// uniform in [-1, 1]
+static double jitter_unit(void) {
+        return 2.0 * rand() / RAND_MAX - 1;
+}
+
+static uint32_t to_ticks(double t) {
+        return (uint32_t)(t * SIM_TICK_HZ);
+}
+
+// the edges in time order with the gate calls, from an edge at a random phase.
+// returns the average of READINGS results after the first, in Hz
+static double measure(double hz, const struct freq_config *config, struct freq_result *last) {
+        struct freq_counter f;
+        double t = 0;
+        double next_edge = (double)rand() / RAND_MAX / hz;
+        double sum = 0;
+        int readings = -1; // the first gate opened mid period
+        uint16_t lap = freq_count_start(&f, config, SIM_TICK_HZ, 0);
+        double next_gate = (double)lap / SIM_TICK_HZ;
+
+        while (readings < READINGS && t < SIM_LIMIT_S) {
+                if (next_edge < next_gate) {
+                        t = next_edge;
+                        freq_count_edge(&f, to_ticks(t));
+                        next_edge += (1 + jitter * jitter_unit()) / hz;
+                        continue;
+                }
+
+                t = next_gate;
+                if (freq_count_gate(&f, to_ticks(t), &lap)) {
+                        freq_count_result(&f, &f.window, last);
+                        if (readings++ >= 0) {
+                                sum += last->value;
+                        }
+                }
+                next_gate += (double)lap / SIM_TICK_HZ;
+        }
+        return readings > 0 ? sum / readings / pow(10, config->decimals) : 0;
+}
+
+
+
+// ************************************************************************ main
+int main(int argc, char **argv) {
+        unsigned int seed = 1;
+        int failures = 0;
+        unsigned int m;
+        unsigned int g;
+        unsigned int i;
+
+        for (i = 1; i < (unsigned int)argc; i++) {
+                if (!strcmp(argv[i], "--jitter") && i + 1 < (unsigned int)argc) {
+                        jitter = atof(argv[++i]) / 100;
+                } else if (!strcmp(argv[i], "--seed") && i + 1 < (unsigned int)argc) {
+                        seed = strtoul(argv[++i], NULL, 0);
+                } else {
+                        jitter = -1;
+                        break;
+                }
+        }
+
+        if (jitter < 0 || jitter >= 1) {
+                fprintf(stderr, "usage: %s [--jitter PCT (0-99)] [--seed N]\n", argv[0]);
+                return 2;
+        }
+
+        srand(seed);
+        for (m = kFreqGated; m <= kFreqAuto; m++) {
+                for (g = 0; g < sizeof(kGates) / sizeof(kGates[0]); g++) {
+                        printf("%s, gate %ums\n", kModeNames[m], kGates[g]);
+                        for (i = 0; i < sizeof(kFrequencies) / sizeof(kFrequencies[0]); i++) {
+                                struct freq_config config = {kGates[g], m, DECIMALS};
+                                struct freq_result result = {0};
+                                double hz = kFrequencies[i];
+                                double got = measure(hz, &config, &result);
+                                double error_pct = fabs(got - hz) / hz * 100;
+                                double edges = hz * kGates[g] / 1000;
+                                double bound_pct;
+                                int checked = !jitter;
+
+                                // half a unit of the last decimal for the rounding
+                                if (result.mode == kFreqGated) {
+                                        bound_pct = 100 / edges;
+                                        checked &= edges >= 2;
+                                } else {
+                                        bound_pct = 100.0 * 2 * hz / SIM_TICK_HZ
+                                                        / (result.periods ? result.periods : 1);
+                                }
+                                bound_pct += 100 * 0.5e-3 / hz;
+
+                                int pass = !checked || error_pct <= bound_pct;
+                                failures += !pass;
+                                printf("  %9.3f Hz -> %12.3f Hz  (%s) error %8.4f%%  bound %8.4f%%%s\n",
+                                                hz, got, kModeNames[result.mode], error_pct,
+                                                bound_pct, pass ? "" : "  FAIL");
+                        }
+                }
+        }
+
+        printf(failures ? "FAIL\n" : "PASS\n");
+        return failures ? 1 : 0;
+}
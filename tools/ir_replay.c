@@ -0,0 +1,482 @@
+/*
+ * File:   ir_replay.c
+ *
+ * Host-side replay harness for the IR decoder. Reads a captured trace in the
+ * format of src/output_example.txt ("pin value, elapsed time" hex pairs, one
+ * edge per line, elapsed times in us), splits it into frames the same way the
+ * receiver does (12ms gap), and runs every frame through src/ir_decode.c.
+ *
+ * build & run (from the repo root):
+ *      gcc -O2 -Wall -Wextra -Isrc -o ir_replay tools/ir_replay.c src/ir_decode.c
+ *      ./ir_replay src/output_example.txt --expect e0e040bf
+ *
+ * options:
+ *      --expect HEX    raw code every decoded frame must match
+ *      --trials N      jittered replays per error step (default 1000)
+ *      --seed N        seed for the jitter generator (default 1)
+ *
+ * after the replay, the first frame that decodes is also run at other remote
+ * speeds through ir_tracker, which must settle on that speed, and with a
+ * glitch cut into each of its pulses through the receiver's edge filter.
+ * last it is timed through ir_decode, and its 32 data bits through the old
+ * classifier (pulses converted to us in double math) and the tick windows
+ *
+ * the exit status is 0 only if at least one frame decoded, all decoded frames
+ * matched --expect, the tracker and glitch checks passed and both
+ * classifiers read the same bits
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ir_decode.h"
+
+#define REPLAY_TICK_HZ 500000UL // same as TIMESTAMP_TICK_HZ in Timer.h
+#define GAP_US 12000            // same as kGapTicks in samsung_rx.c
+#define MAX_PULSES 68           // same as MAX_PULSES in samsung_rx.c
+#define MAX_FRAMES 16
+#define MAX_ERROR_PCT 40
+#define ERROR_STEP_PCT 2
+#define BENCH_ITERATIONS 200000
+#define PD_BITS 32              // pulse distance frame, same as kPulseDistanceBits
+#define MIN_PULSE_US 150        // same as kMinPulseTicks in samsung_rx.c
+#define MIN_CONFIDENCE 10       // same as kMinConfidence in samsung_rx.c
+#define GLITCH_US 20
+#define TRACKER_FRAMES 20
+#define TRACKER_TOLERANCE_Q8 3  // the moving average stops moving within 4
+
+struct trace_frame {
+        uint16_t pulses_us[MAX_PULSES];
+        uint8_t count;
+        unsigned char overrun;
+};
+
+static const struct ir_timing kTiming = IR_TIMING_TABLE(REPLAY_TICK_HZ);
+IR_TIMING_CHECK(REPLAY_TICK_HZ);
+
+static struct trace_frame frames[MAX_FRAMES];
+static int frame_count = 0;
+
+
+
+// ************************************************************ helper functions
+static uint16_t us_to_ticks(double us) {
+        double ticks = us * REPLAY_TICK_HZ / 1000000.0;
+        if (ticks < 0) {
+                return 0;
+        }
+        return ticks > 0xffff ? 0xffff : (uint16_t)(ticks + 0.5);
+}
+
+static void to_ticks(const struct trace_frame *frame, uint16_t *ticks) {
+        uint8_t i;
+        for (i = 0; i < frame->count; i++) {
+                ticks[i] = us_to_ticks(frame->pulses_us[i]);
+        }
+}
+
+// same segmentation as the receiver: a frame starts on a mark, ends on a gap
+static int load_trace(const char *path) {
+        char line[256];
+        unsigned int pin;
+        unsigned int elapsed;
+        struct trace_frame *frame = NULL;
+
+        FILE *file = fopen(path, "r");
+        if (!file) {
+                perror(path);
+                return -1;
+        }
+
+        while (fgets(line, sizeof(line), file)) {
+                if (sscanf(line, " 0x%x 0x%x", &pin, &elapsed) != 2) {
+                        continue; // comments, watchdog messages, blank lines
+                }
+
+                if (frame && elapsed >= GAP_US) {
+                        frame = NULL; // gap: the previous frame is complete
+                }
+
+                if (!frame) {
+                        if (pin != 1 || frame_count == MAX_FRAMES) {
+                                continue; // idle, or edge into a space
+                        }
+                        frame = &frames[frame_count++];
+                        memset(frame, 0, sizeof(*frame));
+                        continue;
+                }
+
+                if (frame->count < MAX_PULSES) {
+                        frame->pulses_us[frame->count++] = elapsed;
+                } else {
+                        frame->overrun = 1;
+                }
+        }
+
+        fclose(file);
+        return frame_count;
+}
+
+static void print_frame(const struct ir_frame *frame) {
+        printf("%-7s address 0x%04x command 0x%04x raw 0x%08lx%s  confidence %u deviation %u%%",
+                        ir_protocol_name(frame->protocol), frame->address, frame->command,
+                        (unsigned long)frame->raw, frame->repeat ? " (repeat)" : "",
+                        frame->confidence, frame->deviation_pct);
+}
+
+// uniform in [-1, 1]
+static double jitter_unit(void) {
+        return 2.0 * rand() / (double)RAND_MAX - 1.0;
+}
+
+// the classifier before the tick windows: every pulse converted to us in
+// double math, then the +-20% windows worked out from the us nominal
+#define US_IN_WINDOW(val, us) ((val) > (us) * 4L / 5 && (val) < (us) * 6L / 5)
+
+static int classify_float(const uint16_t *ticks, uint8_t count, uint32_t *bits) {
+        uint16_t pulses_us[MAX_PULSES];
+        uint32_t output = 0;
+        uint8_t i;
+
+        for (i = 0; i < count; i++) {
+                pulses_us[i] = ticks[i] * (1000000.0 / REPLAY_TICK_HZ);
+        }
+        if (count < 2 + 2 * PD_BITS) {
+                return 0;
+        }
+        for (i = 0; i < PD_BITS; i++) {
+                uint16_t mark = pulses_us[2 + 2 * i];
+                uint16_t space = pulses_us[3 + 2 * i];
+                if (!US_IN_WINDOW(mark, 560)) {
+                        return 0;
+                }
+                if (US_IN_WINDOW(space, 560)) {
+                        output <<= 1;
+                } else if (US_IN_WINDOW(space, 1690)) {
+                        output = (output << 1) | 1;
+                } else {
+                        return 0;
+                }
+        }
+        *bits = output;
+        return 1;
+}
+
+// the same bits from the raw ticks and the precomputed windows
+static int classify_ticks(const uint16_t *ticks, uint8_t count, uint32_t *bits) {
+        const struct ir_window *w = kTiming.w;
+        uint32_t output = 0;
+        uint8_t i;
+
+        if (count < 2 + 2 * PD_BITS) {
+                return 0;
+        }
+        for (i = 0; i < PD_BITS; i++) {
+                uint16_t mark = ticks[2 + 2 * i];
+                uint16_t space = ticks[3 + 2 * i];
+                if (mark <= w[kSymBitMark].min || mark >= w[kSymBitMark].max) {
+                        return 0;
+                }
+                if (space > w[kSymZeroSpace].min && space < w[kSymZeroSpace].max) {
+                        output <<= 1;
+                } else if (space > w[kSymOneSpace].min && space < w[kSymOneSpace].max) {
+                        output = (output << 1) | 1;
+                } else {
+                        return 0;
+                }
+        }
+        *bits = output;
+        return 1;
+}
+
+static double seconds_now(void) {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+
+// ***************************************************************** the stages
+static int replay_frames(int have_expect, uint32_t expect, int *decoded_frames) {
+        int i;
+        int mismatches = 0;
+        uint16_t ticks[MAX_PULSES];
+        struct ir_frame frame;
+
+        *decoded_frames = 0;
+        for (i = 0; i < frame_count; i++) {
+                to_ticks(&frames[i], ticks);
+                int decoded = ir_decode(ticks, frames[i].count, &kTiming, &frame);
+
+                printf("frame %d: %2u pulses%s  ", i, frames[i].count,
+                                frames[i].overrun ? " (overrun)" : "");
+                if (!decoded) {
+                        printf("not decoded (looked like %s)\n", ir_protocol_name(frame.protocol));
+                        continue;
+                }
+
+                (*decoded_frames)++;
+                print_frame(&frame);
+                if (have_expect && frame.raw != expect) {
+                        printf("  MISMATCH, expected 0x%08lx", (unsigned long)expect);
+                        mismatches++;
+                }
+                printf("\n");
+        }
+        return mismatches;
+}
+
+// success rate versus uniformly distributed per-pulse timing error. decoded is
+// what ir_decode gets right, accepted what the receiver keeps of that: frames
+// under MIN_CONFIDENCE are dropped there
+static void jitter_sweep(const struct trace_frame *source, uint32_t expect, int trials) {
+        int error_pct;
+        uint16_t ticks[MAX_PULSES];
+        struct ir_frame frame;
+
+        printf("\njitter sweep, %d trials per step (uniform +-error on every pulse)\n", trials);
+        printf(" error  decoded  accepted  confidence\n");
+        for (error_pct = 0; error_pct <= MAX_ERROR_PCT; error_pct += ERROR_STEP_PCT) {
+                int ok = 0;
+                int accepted = 0;
+                long confidence_sum = 0;
+                int trial;
+                for (trial = 0; trial < trials; trial++) {
+                        uint8_t i;
+                        for (i = 0; i < source->count; i++) {
+                                double scale = 1.0 + jitter_unit() * error_pct / 100.0;
+                                ticks[i] = us_to_ticks(source->pulses_us[i] * scale);
+                        }
+                        if (ir_decode(ticks, source->count, &kTiming, &frame) && frame.raw == expect) {
+                                ok++;
+                                accepted += frame.confidence >= MIN_CONFIDENCE;
+                                confidence_sum += frame.confidence;
+                        }
+                }
+
+                double rate = 100.0 * accepted / trials;
+                int bar = (int)(rate / 2.5 + 0.5);
+                printf("  %3d%%  %6.1f%%   %6.1f%%  %6.1f    |%.*s\n", error_pct,
+                                100.0 * ok / trials, rate,
+                                ok ? (double)confidence_sum / ok : 0.0, bar,
+                                "########################################");
+        }
+}
+
+// a remote running fast or slow by speed: the windows must follow it there
+static int tracker_check(const struct trace_frame *source, uint32_t expect) {
+        static const double kSpeeds[] = {0.82, 0.88, 0.94, 1.0, 1.06, 1.10};
+        uint16_t ticks[MAX_PULSES];
+        struct ir_tracker tracker;
+        struct ir_frame frame;
+        unsigned int s;
+        int failures = 0;
+
+        printf("\ntracker, %d frames per remote speed\n", TRACKER_FRAMES);
+        printf(" speed  expect  settled  decoded\n");
+        for (s = 0; s < sizeof(kSpeeds) / sizeof(kSpeeds[0]); s++) {
+                enum IR_PROTOCOL protocol = kIrUnknown;
+                int decoded_frames = 0;
+                int n;
+                uint8_t i;
+
+                ir_tracker_init(&tracker, &kTiming);
+                for (n = 0; n < TRACKER_FRAMES; n++) {
+                        for (i = 0; i < source->count; i++) {
+                                ticks[i] = us_to_ticks(source->pulses_us[i] * kSpeeds[s]);
+                        }
+                        int decoded = ir_decode(ticks, source->count, &tracker.timing, &frame)
+                                        && frame.raw == expect;
+                        decoded_frames += decoded;
+                        if (frame.protocol != kIrUnknown) {
+                                protocol = frame.protocol;
+                        }
+                        ir_tracker_update(&tracker, &kTiming, &frame, decoded);
+                }
+
+                // what the nominal windows measure, the trace itself is off nominal
+                ir_decode(ticks, source->count, &kTiming, &frame);
+                int want = frame.speed_q8;
+                int got = protocol == kIrUnknown ? 0 : tracker.scale_q8[protocol];
+                int ok = abs(got - want) <= TRACKER_TOLERANCE_Q8;
+                failures += !ok;
+                printf("  %.2f     %3d      %3d    %2d/%d%s\n", kSpeeds[s], want, got,
+                                decoded_frames, TRACKER_FRAMES, ok ? "" : "  FAIL");
+        }
+        return failures;
+}
+
+// the frame as edges, with a GLITCH_US spike in the middle of pulse hit (and
+// of pulse hit2 if different), through the receiver's filter and the decoder
+static int glitched_decodes(const struct trace_frame *source, uint8_t hit, uint8_t hit2,
+                uint32_t expect) {
+        uint16_t pulses[MAX_PULSES];
+        uint8_t count = 0;
+        uint16_t last_edge = 1000; // the edge that started the frame
+        uint16_t edge = last_edge;
+        uint16_t min_ticks = us_to_ticks(MIN_PULSE_US);
+        uint16_t spike = us_to_ticks(GLITCH_US);
+        struct ir_frame frame;
+        uint8_t i;
+
+        for (i = 0; i < source->count; i++) {
+                uint16_t length = us_to_ticks(source->pulses_us[i]);
+                if (i == hit || i == hit2) {
+                        uint16_t mid = edge + length / 2;
+                        if (ir_filter_edge(pulses, &count, MAX_PULSES, &last_edge, mid,
+                                        min_ticks) != kIrEdgeStored) {
+                                return 0;
+                        }
+                        if (ir_filter_edge(pulses, &count, MAX_PULSES, &last_edge, mid + spike,
+                                        min_ticks) != kIrEdgeGlitch) {
+                                return 0;
+                        }
+                }
+                edge += length;
+                ir_filter_edge(pulses, &count, MAX_PULSES, &last_edge, edge, min_ticks);
+        }
+        return count == source->count && ir_decode(pulses, count, &kTiming, &frame)
+                        && frame.raw == expect;
+}
+
+static int glitch_check(const struct trace_frame *source, uint32_t expect) {
+        int single = 0;
+        int pairs = 0;
+        int pair_trials = 0;
+        uint8_t i;
+        uint8_t j;
+
+        for (i = 0; i < source->count; i++) {
+                single += glitched_decodes(source, i, i, expect);
+                for (j = i + 1; j < source->count; j += 7) {
+                        pairs += glitched_decodes(source, i, j, expect);
+                        pair_trials++;
+                }
+        }
+        printf("\nglitch filter, %dus spikes cut into the pulses\n", GLITCH_US);
+        printf("  one per frame: %d/%u decoded, two per frame: %d/%d decoded\n",
+                        single, source->count, pairs, pair_trials);
+        return (single != source->count) + (pairs != pair_trials);
+}
+
+// ns per frame of classify over BENCH_ITERATIONS. the first bit mark moves by
+// a tick every other call so the compiler can't hoist the work out of the loop
+static double time_classifier(int (*classify)(const uint16_t *, uint8_t, uint32_t *),
+                uint16_t *ticks, uint8_t count, uint32_t *bits) {
+        uint16_t mark = ticks[2];
+        volatile uint32_t sink = 0;
+        long i;
+
+        double start = seconds_now();
+        for (i = 0; i < BENCH_ITERATIONS; i++) {
+                ticks[2] = mark + (i & 1);
+                if (classify(ticks, count, bits)) {
+                        sink += *bits;
+                }
+        }
+        double elapsed = seconds_now() - start;
+        ticks[2] = mark;
+        return elapsed * 1e9 / BENCH_ITERATIONS;
+}
+
+static int benchmark(const struct trace_frame *source) {
+        uint16_t ticks[MAX_PULSES];
+        struct ir_frame frame;
+        volatile int sink = 0;
+        uint32_t float_bits = 0;
+        uint32_t tick_bits = 0;
+        long i;
+
+        to_ticks(source, ticks);
+
+        double start = seconds_now();
+        for (i = 0; i < BENCH_ITERATIONS; i++) {
+                sink += ir_decode(ticks, source->count, &kTiming, &frame);
+        }
+        double elapsed = seconds_now() - start;
+
+        printf("\ndecode time: %.1f ns per frame (%d iterations, host cpu)\n",
+                        elapsed * 1e9 / BENCH_ITERATIONS, BENCH_ITERATIONS);
+
+        // the pulse distance bits of the frame, old float classifier against
+        // the tick windows. both must agree on the bits
+        if (!classify_ticks(ticks, source->count, &tick_bits)) {
+                printf("classify time: not a pulse distance frame, skipped\n");
+                return 0;
+        }
+        double float_ns = time_classifier(classify_float, ticks, source->count, &float_bits);
+        double tick_ns = time_classifier(classify_ticks, ticks, source->count, &tick_bits);
+        int agree = classify_float(ticks, source->count, &float_bits) && float_bits == tick_bits;
+        printf("classify time: float us %.1f ns, tick windows %.1f ns per frame (%.1fx)%s\n",
+                        float_ns, tick_ns, tick_ns > 0 ? float_ns / tick_ns : 0.0,
+                        agree ? "" : "  FAIL, the bits differ");
+        return !agree;
+}
+
+
+
+// ************************************************************************ main
+int main(int argc, char **argv) {
+        const char *path = NULL;
+        int have_expect = 0;
+        uint32_t expect = 0;
+        int trials = 1000;
+        unsigned int seed = 1;
+        int decoded_frames;
+        int i;
+
+        for (i = 1; i < argc; i++) {
+                if (!strcmp(argv[i], "--expect") && i + 1 < argc) {
+                        expect = strtoul(argv[++i], NULL, 16);
+                        have_expect = 1;
+                } else if (!strcmp(argv[i], "--trials") && i + 1 < argc) {
+                        trials = atoi(argv[++i]);
+                } else if (!strcmp(argv[i], "--seed") && i + 1 < argc) {
+                        seed = strtoul(argv[++i], NULL, 0);
+                } else if (!path) {
+                        path = argv[i];
+                } else {
+                        path = NULL;
+                        break;
+                }
+        }
+
+        if (!path || trials <= 0) {
+                fprintf(stderr, "usage: %s trace.txt [--expect HEX] [--trials N] [--seed N]\n",
+                                argv[0]);
+                return 2;
+        }
+
+        if (load_trace(path) <= 0) {
+                fprintf(stderr, "%s: no frames found\n", path);
+                return 1;
+        }
+
+        int mismatches = replay_frames(have_expect, expect, &decoded_frames);
+        if (decoded_frames == 0) {
+                printf("no frame decoded\n");
+                return 1;
+        }
+
+        // the sweep and benchmark use the first frame that decodes cleanly
+        struct ir_frame frame;
+        uint16_t ticks[MAX_PULSES];
+        for (i = 0; i < frame_count; i++) {
+                to_ticks(&frames[i], ticks);
+                if (ir_decode(ticks, frames[i].count, &kTiming, &frame)) {
+                        break;
+                }
+        }
+
+        srand(seed);
+        jitter_sweep(&frames[i], have_expect ? expect : frame.raw, trials);
+        int failures = tracker_check(&frames[i], frame.raw);
+        failures += glitch_check(&frames[i], frame.raw);
+        failures += benchmark(&frames[i]);
+
+        return mismatches || failures ? 1 : 0;
+}